@@ -0,0 +1,96 @@
+#include "Arduino.h"
+#include "cronos.hpp"
+#include <WiFi.h>
+#include "time.h"
+#include "esp_sntp.h"
+
+
+// We need WiFi connection to get time from ntp
+const char *ssid = "YOUR_SSID";
+const char *password = "YOUR_PASS";
+
+const char *ntpServer1 = "pool.ntp.org";
+const char *ntpServer2 = "time.nist.gov";
+
+// TimeZone rule for Europe/Moscow
+const char *time_zone = "MSK-3";
+
+
+// CronoS object
+CronoS cron;
+
+
+// this function prints local time
+void printLocalTime() {
+  struct tm timeinfo;
+  if (!getLocalTime(&timeinfo)) {
+    Serial.println("No time available (yet)");
+    return;
+  }
+  Serial.println(&timeinfo, "%A, %B %d %Y %H:%M:%S");
+}
+
+// Callback function (gets called when time adjusts via NTP)
+void timeavailable(struct timeval *t) {
+  Serial.println("Got time adjustment from NTP!");
+  printLocalTime();
+  // reevaluate rules on time change
+  cron.reload();
+}
+
+
+/**
+ * A multi-step job written as a coroutine
+ * each co_await suspends the job until the next fire time of a given rule,
+ * the job is resumed from the scheduler's context, same as callbacks.
+ * No tasks are registered in scheduler and no flags are needed to keep the state between steps
+ */
+CronoS_Coro blink_job(){
+  pinMode(LED_BUILTIN, OUTPUT);
+  for (;;){
+    // switch LED on at every 10th second
+    co_await cron.next("*/10 * * * * *");
+    digitalWrite(LED_BUILTIN, HIGH);
+    printLocalTime();
+    Serial.println("LED on");
+
+    // and switch it off 3 seconds later
+    co_await cron.next("3-59/10 * * * * *");
+    digitalWrite(LED_BUILTIN, LOW);
+    printLocalTime();
+    Serial.println("LED off");
+  }
+}
+
+
+void setup() {
+    Serial.begin(115200);
+
+    // First step is to configure WiFi STA and connect in order to get the current time and date.
+    Serial.printf("Connecting to %s ", ssid);
+    WiFi.begin(ssid, password);
+
+    while (WiFi.status() != WL_CONNECTED) {
+        delay(500);
+        Serial.print(".");
+    }
+    Serial.println(" CONNECTED");
+
+    // set ntp notification call-back function
+    sntp_set_time_sync_notification_cb(timeavailable);
+
+    // Set NTP and timezone
+    configTzTime(time_zone, ntpServer1, ntpServer2);
+
+    // start Cron scheduler
+    cron.start();
+
+    // start the coroutine, it runs until the first co_await and returns here
+    blink_job();
+}
+
+
+void loop() {
+    // nothing to do here
+    delay(1000);
+}
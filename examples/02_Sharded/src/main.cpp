@@ -0,0 +1,64 @@
+#include "Arduino.h"
+#include "cronos.hpp"
+
+
+// number of jobs firing at the same second
+#define JOBS  64
+// CPU time each job spends, us
+#define JOB_COST  2000
+
+
+// time when the first and the last job of a burst was done
+static std::atomic<uint32_t> first_done{0}, last_done{0};
+
+
+// a job that keeps CPU busy for a while, like parsing a sensor frame or composing an MQTT message
+void busy_job(cronos_tid id, void* arg){
+  uint32_t start = micros();
+  while (micros() - start < JOB_COST) {}
+  uint32_t t = micros();
+  uint32_t zero = 0;
+  first_done.compare_exchange_strong(zero, t);
+  last_done = t;
+}
+
+/**
+ * runs the same burst of jobs for a few seconds with a given number of shards
+ * and prints how long it took to drain it
+ */
+void bench(unsigned shards){
+  CronoS_Sharded cron(shards);
+
+  // jobs are spread over shards by their id
+  for (int i = 0; i != JOBS; ++i)
+    cron.addCallback("* * * * * *", busy_job);
+
+  cron.start();
+  for (int i = 0; i != 5; ++i){
+    first_done = 0;
+    delay(1000);
+    Serial.printf("shards: %u, burst of %d jobs drained in %lu us\n", (unsigned)cron.size(), JOBS, (unsigned long)(last_done - first_done + JOB_COST));
+  }
+  cron.stop();
+
+  auto st = cron.getStats();
+  Serial.printf("shards: %u, runs: %lu, wakeups: %lu\n\n", (unsigned)cron.size(), (unsigned long)st.runs, (unsigned long)st.wakeups);
+}
+
+
+void setup() {
+    Serial.begin(115200);
+    // no need for a real time here, clock is running since boot and every job fires each second
+
+    // all jobs on a single scheduler
+    bench(1);
+
+    // one shard per CPU core, jobs run in parallel
+    bench(0);
+}
+
+
+void loop() {
+    // nothing to do here
+    delay(1000);
+}
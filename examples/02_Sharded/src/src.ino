@@ -0,0 +1,8 @@
+/*
+
+This file is just a stub to make Arduino IDE happy
+
+Pls, see main.cpp for sketch code
+
+
+*/
\ No newline at end of file
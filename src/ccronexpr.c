@@ -30,6 +30,7 @@ https://github.com/exander77/supertinycron
 
 
 #include <stdlib.h>
+#include <stddef.h>
 #include <ctype.h>
 #include <errno.h>
 #include <string.h>
@@ -148,7 +149,7 @@ struct tm* cron_time(time_t* date, struct tm* out) {
 #define TOKEN_COMPARE(context, token)   if (context->err) goto error; if (token == context->type) token_next(context); else goto compare_error;
 #define GET_BYTE(idx)                   (uint8_t) (idx / 8)
 #define GET_BIT(idx)                    (uint8_t) (idx % 8)
-#define MKTIME(calendar)                if (CRON_INVALID_INSTANT == cron_mktime(calendar)) goto return_error;
+#define MKTIME(calendar, tz)            if (CRON_INVALID_INSTANT == calendar_mktime(calendar, tz)) goto return_error;
 #define STRCATC(dest, buf, inc_len)     do { len += inc_len; if (len > buffer_len) return -1; strcat(dest, buf); } while (0)
 #define GFC(dest, bits, min, max, offset, buffer_len) \
                                         { tmp = generate_field(dest, bits, min, max, offset, buffer_len); if (tmp < 0) return tmp; else len += tmp; }
@@ -180,55 +181,198 @@ static int* get_field_ptr(struct tm* calendar, int field) {
     }
 }
 
-static int last_day_of_month(int month, int year, int is_weekday) {
-    struct tm calendar;
-    time_t t;
-    memset(&calendar, 0, sizeof(struct tm));
-    calendar.tm_mon = month + 1; /* next month */
-    calendar.tm_year = year; /* years since 1900 */
-    t = cron_mktime(&calendar);
+/**
+ * Days since 1970-01-01 of the given date in proleptic Gregorian calendar.
+ */
+static long days_from_civil(int year, int month, int day) {
+    long era, yoe, doy;
+    year -= month <= 2;
+    era = (year >= 0 ? year : year - 399) / 400;
+    yoe = year - era * 400;
+    doy = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    return era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468;
+}
+
+/**
+ * Civil date of the date given as days since 1970-01-01, inverse of days_from_civil().
+ */
+static void civil_from_days(long days, int* year, int* month, int* mday) {
+    long era, doe, yoe, doy, mp;
+    days += 719468;
+    era = (days >= 0 ? days : days - 146096) / 146097;
+    doe = days - era * 146097;
+    yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+    doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+    mp = (5 * doy + 2) / 153;
+    *mday = (int) (doy - (153 * mp + 2) / 5 + 1);
+    *month = (int) (mp < 10 ? mp + 3 : mp - 9);
+    *year = (int) (yoe + era * 400 + (*month <= 2));
+}
+
+static int mday_from_days(long days) {
+    int year, month, mday;
+    civil_from_days(days, &year, &month, &mday);
+    return mday;
+}
+
+static int weekday_from_days(long days) {
+    return (int) ((days % WEEK_DAYS + WEEK_DAYS + 4) % WEEK_DAYS); /* 1970-01-01 was Thursday */
+}
+
+static int days_in_month(int month, int year) {
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    year += YEAR_OFFSET;
+    return days[month] + (month == 1 && ((year % 4 == 0 && year % 100 != 0) || year % 400 == 0));
+}
+
+static int last_day_of_month(int month, int year) {
+    /* month could be out of range after it's field has been changed */
+    year += month < 0 ? (month - 11) / CRON_MAX_MONTHS : month / CRON_MAX_MONTHS;
+    return days_in_month((month % CRON_MAX_MONTHS + CRON_MAX_MONTHS) % CRON_MAX_MONTHS, year);
+}
+
+/**
+ * POSIX TZ rules, e.g. "CET-1CEST,M3.5.0,M10.5.0/3".
+ * Offsets are kept as seconds east of UTC, DST transitions are calculated per year with calendar arithmetic,
+ * so conversions do not depend on the process-wide timezone and are reentrant.
+ */
+static time_t floor_div(time_t a, time_t b) {
+    return a >= 0 ? a / b : -((-a - 1) / b) - 1;
+}
 
-    if (is_weekday) {
-        /* If the last day of the month is a Saturday (6) or Sunday (0), decrement the day. But it is shifted to (5) and (6). */
-        while (cron_time(&t, &calendar)->tm_wday == 6 || cron_time(&t, &calendar)->tm_wday == 0) t -= DAY_SECONDS; /* subtract a day */
+static const char* tz_name(const char* s) {
+    const char* b = s;
+    if ('<' == *s) {
+        for (s++; *s && '>' != *s; s++) if (!isalnum((unsigned char) *s) && '+' != *s && '-' != *s) return NULL;
+        return '>' == *s && s - b > 3 ? s + 1 : NULL;
     }
+    while (isalpha((unsigned char) *s)) s++;
+    return s - b >= 3 ? s : NULL;
+}
 
-    return cron_time(&t, &calendar)->tm_mday;
+static const char* tz_number(const char* s, int min, int max, int* value) {
+    int v = 0;
+    if (!isdigit((unsigned char) *s)) return NULL;
+    for (; isdigit((unsigned char) *s); s++) if ((v = v * 10 + *s - '0') > max) return NULL;
+    if (v < min) return NULL;
+    *value = v;
+    return s;
 }
 
-static int closest_weekday(int day_of_month, int month, int year) {
-    struct tm calendar;
-    time_t t;
-    int wday;
-    memset(&calendar, 0, sizeof(struct tm));
-    calendar.tm_mon = month; /* given month */
-    calendar.tm_mday = day_of_month + 1;
-    calendar.tm_year = year; /* years since 1900 */
-    t = cron_mktime(&calendar);
+/* [+|-]hh[:mm[:ss]] */
+static const char* tz_time(const char* s, int32_t* value) {
+    int sign = 1, h, m = 0, sec = 0;
+    if ('+' == *s || '-' == *s) sign = '-' == *s++ ? -1 : 1;
+    if (!(s = tz_number(s, 0, 167, &h))) return NULL;
+    if (':' == *s && !(s = tz_number(s + 1, 0, 59, &m))) return NULL;
+    if (':' == *s && !(s = tz_number(s + 1, 0, 59, &sec))) return NULL;
+    *value = sign * (h * 3600 + m * 60 + sec);
+    return s;
+}
 
-    wday = cron_time(&t, &calendar)->tm_wday;
+/* Mm.w.d, Jn or n followed by optional /time */
+static const char* tz_transition(const char* s, cron_tz_transition* t) {
+    int a, b, c;
+    t->time = 2 * 3600;
+    if ('M' == *s) {
+        if (!(s = tz_number(s + 1, 1, 12, &a)) || '.' != *s || !(s = tz_number(s + 1, 1, 5, &b))
+            || '.' != *s || !(s = tz_number(s + 1, 0, 6, &c))) return NULL;
+        t->type = 'M';
+        t->month = (uint8_t) a;
+        t->week = (uint8_t) b;
+        t->wday = (uint8_t) c;
+    } else if ('J' == *s) {
+        if (!(s = tz_number(s + 1, 1, 365, &a))) return NULL;
+        t->type = 'J';
+        t->day = (int16_t) a;
+    } else {
+        if (!(s = tz_number(s, 0, 365, &a))) return NULL;
+        t->type = 'D';
+        t->day = (int16_t) a;
+    }
+    if ('/' == *s) s = tz_time(s + 1, &t->time);
+    return s;
+}
 
-    /* If it's a Sunday */
-    if (wday == 0) {
-        /* If it's the last day of the month, go to the previous Friday */
-        if (day_of_month + 1 == last_day_of_month(month, year, 0)) t -= 2 * DAY_SECONDS;
-        else t += DAY_SECONDS; /* go to the next Monday */
-    /* If it's a Saturday */
-    } else if (wday == 6) {
-        /* If it's the first day of the month, go to the next Monday */
-        if (day_of_month == 0) t += 2 * DAY_SECONDS;
-        else t -= DAY_SECONDS; /* go to the previous Friday */
+/**
+ * Local time of the transition in the given year, seconds since 1970-01-01.
+ */
+static time_t tz_transition_time(const cron_tz_transition* t, int year) {
+    long day = days_from_civil(year, 1, 1), first;
+    if ('J' == t->type) day += t->day - 1 + (t->day >= 60 && 29 == days_in_month(1, year - YEAR_OFFSET));
+    else if ('D' == t->type) day += t->day;
+    else {
+        first = days_from_civil(year, t->month, 1);
+        day = first + (t->wday - weekday_from_days(first) + WEEK_DAYS) % WEEK_DAYS + (t->week - 1) * WEEK_DAYS;
+        /* week 5 is the last one of the month */
+        if (day >= first + days_in_month(t->month - 1, year - YEAR_OFFSET)) day -= WEEK_DAYS;
     }
+    return (time_t) day * DAY_SECONDS + t->time;
+}
+
+static int tz_is_dst(const cron_tz* tz, time_t date) {
+    int year, month, mday;
+    time_t start, end;
+    if (!tz->has_dst) return 0;
+    civil_from_days((long) floor_div(date + tz->std_offset, DAY_SECONDS), &year, &month, &mday);
+    /* start is given in standard time, end in daylight saving time */
+    start = tz_transition_time(&tz->start, year) - tz->std_offset;
+    end = tz_transition_time(&tz->end, year) - tz->dst_offset;
+    return start < end ? date >= start && date < end : date >= start || date < end;
+}
 
-    /* If it's a weekday */
-    return cron_time(&t, &calendar)->tm_mday;
+/**
+ * Same as localtime_r() in the given timezone.
+ */
+static struct tm* tz_localtime(time_t date, const cron_tz* tz, struct tm* out) {
+    int dst = tz_is_dst(tz, date), year, month, mday;
+    time_t local = date + (dst ? tz->dst_offset : tz->std_offset);
+    long days = (long) floor_div(local, DAY_SECONDS), secs = (long) (local - (time_t) days * DAY_SECONDS);
+    civil_from_days(days, &year, &month, &mday);
+    out->tm_sec = (int) (secs % 60);
+    out->tm_min = (int) (secs / 60 % 60);
+    out->tm_hour = (int) (secs / 3600);
+    out->tm_mday = mday;
+    out->tm_mon = month - 1;
+    out->tm_year = year - YEAR_OFFSET;
+    out->tm_wday = weekday_from_days(days);
+    out->tm_yday = (int) (days - days_from_civil(year, 1, 1));
+    out->tm_isdst = dst;
+    return out;
+}
+
+/**
+ * Same as mktime() in the given timezone, calendar is normalized.
+ * 'tm_isdst' is honored the same way: time is taken in the requested offset if it is set,
+ * otherwise ambiguous time is taken as daylight saving time and time in the gap as standard time.
+ */
+static time_t tz_mktime(struct tm* calendar, const cron_tz* tz) {
+    time_t years = floor_div(calendar->tm_mon, CRON_MAX_MONTHS), local, date;
+    int month = (int) (calendar->tm_mon - years * CRON_MAX_MONTHS);
+    local = ((time_t) days_from_civil((int) (calendar->tm_year + YEAR_OFFSET + years), month + 1, 1) + calendar->tm_mday - 1) * DAY_SECONDS
+          + (time_t) calendar->tm_hour * 3600 + (time_t) calendar->tm_min * 60 + calendar->tm_sec;
+    if (!tz->has_dst || 0 == calendar->tm_isdst) date = local - tz->std_offset;
+    else if (calendar->tm_isdst > 0) date = local - tz->dst_offset;
+    else {
+        date = local - tz->dst_offset;
+        if (!tz_is_dst(tz, date)) date = local - tz->std_offset;
+    }
+    tz_localtime(date, tz, calendar);
+    return date;
 }
 
+/**
+ * Normalizes the calendar of cron_next()/cron_prev() search in the timezone of the search,
+ * process-wide one (or UTC) if no timezone is given.
+ */
+static time_t calendar_mktime(struct tm* calendar, const cron_tz* tz) {
+    return tz ? tz_mktime(calendar, tz) : cron_mktime(calendar);
+}
 static void set_field(struct tm* calendar, int field, int val) {
     *get_field_ptr(calendar, field) = val;
     /* Reset day of month after month change to it's maximum. */
     if (field == CRON_CF_MONTH) {
-        val = last_day_of_month(calendar->tm_mon, calendar->tm_year, 0);
+        val = last_day_of_month(calendar->tm_mon, calendar->tm_year);
         if (calendar->tm_mday > val) calendar->tm_mday = val;
     }
 }
@@ -247,7 +391,7 @@ static void reset_max(struct tm* calendar, int field) {
          if (CRON_CF_SECOND       == field) set_field(calendar, field, CRON_MAX_SECONDS-1);
     else if (CRON_CF_MINUTE       == field) set_field(calendar, field, CRON_MAX_MINUTES-1);
     else if (CRON_CF_HOUR_OF_DAY  == field) set_field(calendar, field, CRON_MAX_HOURS  -1);
-    else if (CRON_CF_DAY_OF_MONTH == field) set_field(calendar, field, last_day_of_month(calendar->tm_mon, calendar->tm_year, 0));
+    else if (CRON_CF_DAY_OF_MONTH == field) set_field(calendar, field, last_day_of_month(calendar->tm_mon, calendar->tm_year));
 }
 
 static void reset_all(void (*fn)(struct tm* calendar, int field), struct tm* calendar, uint8_t* fields) {
@@ -255,14 +399,19 @@ static void reset_all(void (*fn)(struct tm* calendar, int field), struct tm* cal
 }
 
 typedef enum { T_ASTERISK, T_QUESTION, T_NUMBER, T_COMMA, T_SLASH, T_L, T_W, T_HASH, T_MINUS, T_WS, T_EOF, T_INVALID } TokenType;
-typedef struct { const char* input; TokenType type; cron_expr* target; int field_type, value, min, max, offset, fix_dow; uint8_t* field; const char* err; } ParserContext;
+typedef struct { const char* input; const char* end; TokenType type; cron_expr* target; int field_type, value, min, max, offset, fix_dow; uint8_t* field; const char* err;
+                 /* tokens recorded for a replay, see cron_parse_expr_n() */
+                 uint16_t* tokens; int ntokens, replay; } ParserContext;
+
+/* tokens of the first five fields kept by cron_parse_expr_n() till it finds out whether seconds field is present */
+#define CRON_PARSE_TOKENS 128
 
 static int compare_strings(const char* str1, const char* str2, size_t len) {
     size_t i; for (i = 0; i < len; i++) if (toupper(str1[i]) != str2[i]) return str1[i] - str2[i]; return 0;
 }
 
-static int match_ordinals(const char* str, const char* const* arr, size_t arr_len) {
-    size_t i; for (i = 0; i < arr_len; i++) if (!compare_strings(str, arr[i], strlen(arr[i]))) return (int)i; return -1;
+static int match_ordinals(const char* str, size_t len, const char* const* arr, size_t arr_len) {
+    size_t i; for (i = 0; i < arr_len; i++) if (len >= strlen(arr[i]) && !compare_strings(str, arr[i], strlen(arr[i]))) return (int)i; return -1;
 }
 
 static int count_fields(const char* str, char del) {
@@ -275,24 +424,24 @@ static int count_fields(const char* str, char del) {
     return (int)count + 1;
 }
 
-static void token_next(ParserContext* context) {
-    const char *input = context->input;
+static void token_read(ParserContext* context) {
+    const char *input = context->input, *end = context->end;
     context->type = T_INVALID;
     context->value = 0;
-    if (*context->input == '\0') context->type = T_EOF;
+    if (context->input == end || *context->input == '\0') context->type = T_EOF;
     else if (isspace(*context->input)) {
-        do ++context->input; while (isspace(*context->input));
+        do ++context->input; while (context->input != end && isspace(*context->input));
         context->type = T_WS;
     } else if (isdigit(*context->input)) {
         do {
             context->value = context->value * 10 + (*context->input - '0');
             ++context->input;
-        } while (isdigit(*context->input));
+        } while (context->input != end && isdigit(*context->input));
         context->type = T_NUMBER;
     } else if (isalpha(*input)) {
-        do  ++input; while (isalpha(*input));
-        context->value = match_ordinals(context->input, DAYS_ARR, CRON_DAYS_ARR_LEN);
-        if (context->value < 0) context->value = match_ordinals(context->input, MONTHS_ARR, CRON_MONTHS_ARR_LEN);
+        do  ++input; while (input != end && isalpha(*input));
+        context->value = match_ordinals(context->input, (size_t)(input - context->input), DAYS_ARR, CRON_DAYS_ARR_LEN);
+        if (context->value < 0) context->value = match_ordinals(context->input, (size_t)(input - context->input), MONTHS_ARR, CRON_MONTHS_ARR_LEN);
         if (context->value < 0) goto rest;
         context->input = input;
         context->type = T_NUMBER;
@@ -312,6 +461,17 @@ static void token_next(ParserContext* context) {
     if (T_INVALID == context->type) context->err = "Invalid token";
 }
 
+static void token_next(ParserContext* context) {
+    if (context->replay == context->ntokens) {
+        token_read(context);
+        return;
+    }
+    /* token recorded by cron_parse_expr_n(), type in the low 4 bits */
+    context->type = (TokenType)(context->tokens[context->replay] & 0xf);
+    context->value = context->tokens[context->replay++] >> 4;
+    if (T_INVALID == context->type) context->err = "Invalid token";
+}
+
 static int Number(ParserContext* context) {
     int value = 0;
     switch (context->type) {
@@ -496,69 +656,207 @@ static void Fields(ParserContext* context, int len) {
     error: return;
 }
 
+static const struct { int field_type, min, max, offset; size_t pos; } FIELDS_ARR[] = {
+    { CRON_CF_SECOND,       0,              CRON_MAX_SECONDS,           0,              offsetof(cron_expr, seconds) },
+    { CRON_CF_MINUTE,       0,              CRON_MAX_MINUTES,           0,              offsetof(cron_expr, minutes) },
+    { CRON_CF_HOUR_OF_DAY,  0,              CRON_MAX_HOURS,             0,              offsetof(cron_expr, hours) },
+    { CRON_CF_DAY_OF_MONTH, 1,              CRON_MAX_DAYS_OF_MONTH,     0,              offsetof(cron_expr, days_of_month) },
+    { CRON_CF_MONTH,        1,              CRON_MAX_MONTHS + 1,       -1,              offsetof(cron_expr, months) },
+    { CRON_CF_DAY_OF_WEEK,  0,              CRON_MAX_DAYS_OF_WEEK + 1,  0,              offsetof(cron_expr, days_of_week) },
+#ifndef CRON_DISABLE_YEARS
+    { CRON_CF_YEAR,         CRON_MIN_YEARS, CRON_MAX_YEARS,            -CRON_MIN_YEARS, offsetof(cron_expr, years) },
+#endif
+};
+#define CRON_FIELDS_ARR_LEN (int)(sizeof(FIELDS_ARR) / sizeof(FIELDS_ARR[0]))
+
+/**
+ * Variant of Fields() for the tokens recorded by cron_parse_expr_n(), the number of fields is known
+ * only as far as whether seconds field is present (first = 0) or not (first = 1), the rest is checked here.
+ */
+static void FieldsRecorded(ParserContext* context, int first) {
+    int i, last = first ? 6 : CRON_FIELDS_ARR_LEN;
+    token_next(context);
+    if (first) cron_set_bit(context->target->seconds, 0);
+    for (i = first; i < last; ) {
+        FieldWrapper(context, FIELDS_ARR[i].field_type, FIELDS_ARR[i].min, FIELDS_ARR[i].max, FIELDS_ARR[i].offset,
+                     (uint8_t*)context->target + FIELDS_ARR[i].pos);
+        if (context->err) goto error;
+        i++;
+        if (T_EOF == context->type) break;
+        token_next(context);
+    }
+    if (T_EOF != context->type) {
+#ifdef CRON_DISABLE_YEARS
+        /* years field is not parsed, skip it */
+        if (i == CRON_FIELDS_ARR_LEN && !first) {
+            while (context->input != context->end && *context->input && !isspace(*context->input)) context->input++;
+            token_next(context);
+        }
+        if (T_EOF != context->type)
+#endif
+        PARSE_ERROR("Invalid number of fields, expression must consist of 5-7 fields");
+    }
+    if (i < 6) PARSE_ERROR("Invalid number of fields, expression must consist of 5-7 fields");
+#ifndef CRON_DISABLE_YEARS
+    if (i < 7) cron_set_bit(context->target->years, EXPR_YEARS_LENGTH*8-1);
+#endif
+    error: return;
+}
+
 /**
  * Search the bits provided for the next/prev set bit after the value provided, and reset the calendar.
  */
-static int find_nextprev(uint8_t* bits, int max, int value, int value_offset, struct tm* calendar, int field, int nextField, uint8_t* lower_orders, int offset) {
+static int find_nextprev(uint8_t* bits, int max, int value, int value_offset, struct tm* calendar, const cron_tz* tz, int field, int nextField, uint8_t* lower_orders, int offset) {
     int next_value = (offset > 0 ? next_set_bit(bits, max, value+value_offset) : prev_set_bit(bits, value+value_offset, 0))-value_offset;
+    struct tm requested;
     /* roll under if needed */
     if (next_value < 0) {
         if (offset > 0) reset_max(calendar, field); else reset_min(calendar, field);
-        add_to_field(calendar, nextField, offset); MKTIME(calendar);
+        add_to_field(calendar, nextField, offset);
+        /* the other day might be across DST change, offset of the current one does not apply */
+        if (nextField > CRON_CF_HOUR_OF_DAY) calendar->tm_isdst = -1;
+        MKTIME(calendar, tz);
         next_value = offset > 0 ? next_set_bit(bits, max, 0) : prev_set_bit(bits, max - 1, value);
     }
     if (next_value < 0 || next_value != value) {
         if (offset > 0) reset_all_min(calendar, lower_orders) else reset_all_max(calendar, lower_orders);
-        set_field(calendar, field, next_value < 0 ? 0 : next_value); MKTIME(calendar);
+        set_field(calendar, field, next_value < 0 ? 0 : next_value);
+        /* day might have been entered across DST change, let mktime() pick the offset of the new hour */
+        if (CRON_CF_HOUR_OF_DAY == field) calendar->tm_isdst = -1;
+        requested = *calendar;
+        MKTIME(calendar, tz);
+        /* hour in the DST gap is moved by mktime(), continue from the first second after the gap or the last one before it */
+        if (CRON_CF_HOUR_OF_DAY == field && calendar->tm_hour != next_value) {
+            *calendar = requested;
+            calendar->tm_hour += offset > 0;
+            calendar->tm_min = 0;
+            calendar->tm_sec = -(offset < 0);
+            MKTIME(calendar, tz);
+        }
     }
     return next_value < 0 ? 0 : next_value; return_error: return -1;
 }
 
-static int find_day_condition(struct tm* calendar, uint8_t* days_of_month, int8_t* dim, int dom, uint8_t* days_of_week, int dow, uint8_t* flags, int* day) {
-    int tmp_day = *day;
-    if (tmp_day < 0) {
-        if ((!*flags && *dim < 0) || *flags & 1) tmp_day = last_day_of_month(calendar->tm_mon, calendar->tm_year, 0);
-        else if (*flags & 2)                     tmp_day = last_day_of_month(calendar->tm_mon, calendar->tm_year, 1);
-        else if (*flags & 4)                     tmp_day = closest_weekday(*dim-1, calendar->tm_mon, calendar->tm_year);
-        *day = tmp_day;
+/**
+ * Reference day of 'L', 'LW' and 'W' rules for the month, same as last_day_of_month() and closest_weekday()
+ * calculate with calendar arithmetic, without mktime().
+ */
+static int special_day(int flags, int dim, int month, int year) {
+    int last = days_in_month(month, year), wday;
+    long first = days_from_civil(year + YEAR_OFFSET, month + 1, 1), day;
+    if ((!flags && dim < 0) || flags & 1) return last;
+    if (flags & 2) {
+        wday = weekday_from_days(first + last - 1);
+        return wday == 6 ? last - 1 : wday == 0 ? last - 2 : last;
     }
-    if (!cron_get_bit(days_of_month, dom) || !cron_get_bit(days_of_week,  dow))                  return 1;
-    if (*flags) {
-        if ((*flags & 3) && dom != tmp_day+1+*dim)                                               return 1;
-        if ((*flags & 4) && dom != tmp_day)                                                      return 1;
-    } else {
-        if (*dim < 0 && (dom < tmp_day+WEEK_DAYS**dim+1 || dom >= tmp_day+WEEK_DAYS*(*dim+1)+1)) return 1;
-        if (*dim > 0 && (dom < WEEK_DAYS*(*dim-1)+1     || dom >= WEEK_DAYS**dim+1))             return 1;
+    if (flags & 4) {
+        /* day past the end of the month is normalized into the next month */
+        day = first + dim - 1;
+        wday = weekday_from_days(day);
+        if (wday == 0) day += dim == last ? -2 : 1;
+        else if (wday == 6) day += dim == 1 ? 2 : -1;
+        return mday_from_days(day);
     }
-    return 0;
+    return -1;
+}
+
+/**
+ * Days of the month that match days of month, days of week, 'L', 'W' and '#' rules, bit n is set for day n.
+ */
+static uint32_t day_mask(cron_expr* expr, int month, int year) {
+    int flags = *expr->flags, dim = *expr->day_in_month, last = days_in_month(month, year);
+    int day = special_day(flags, dim, month, year), dom, dow, from = 1, to = last;
+    uint32_t mask = 0;
+    /* rules narrow the month down to a single day or a week, only those days are checked */
+    if (flags & 3) { if (from < day+1+dim) from = day+1+dim; if (to > day+1+dim) to = day+1+dim; }
+    if (flags & 4) { if (from < day) from = day; if (to > day) to = day; }
+    if (!flags && dim < 0) { if (from < day+WEEK_DAYS*dim+1) from = day+WEEK_DAYS*dim+1; if (to > day+WEEK_DAYS*(dim+1)) to = day+WEEK_DAYS*(dim+1); }
+    if (!flags && dim > 0) { if (from < WEEK_DAYS*(dim-1)+1) from = WEEK_DAYS*(dim-1)+1; if (to > WEEK_DAYS*dim) to = WEEK_DAYS*dim; }
+    if (from > to) return 0;
+    dow = weekday_from_days(days_from_civil(year + YEAR_OFFSET, month + 1, from));
+    for (dom = from; dom <= to; dom++, dow = (dow + 1) % WEEK_DAYS)
+        if (cron_get_bit(expr->days_of_month, dom) && cron_get_bit(expr->days_of_week, dow)) mask |= (uint32_t) 1 << dom;
+    return mask;
+}
+
+/**
+ * Matching days of the last requested month, kept by the caller for the time of one search.
+ */
+typedef struct {
+    uint32_t mask;
+    /* (years since 1900) * 12 + month + 1, 0 - empty */
+    long key;
+} cron_day_cache;
+
+/**
+ * Same as day_mask() memoized in the cache for the last requested month.
+ */
+static uint32_t cached_day_mask(cron_expr* expr, cron_day_cache* cache, int month, int year) {
+    long key = (long) year * 12 + month + 1;
+    if (cache->key != key) {
+        cache->mask = day_mask(expr, month, year);
+        cache->key = key;
+    }
+    return cache->mask;
+}
+
+static int find_day_condition(struct tm* calendar, cron_expr* expr, cron_day_cache* cache, int dom, int dow) {
+    if (!*expr->flags && !*expr->day_in_month)
+        return !cron_get_bit(expr->days_of_month, dom) || !cron_get_bit(expr->days_of_week, dow);
+    return !(cached_day_mask(expr, cache, calendar->tm_mon, calendar->tm_year) >> dom & 1);
+}
+
+/**
+ * Same as find_day() for 'L', 'W' and '#' rules, scans cached masks of matching days month by month
+ * instead of stepping day by day, calendar is updated only once the day is found.
+ */
+static int find_day_masked(struct tm* calendar, const cron_tz* tz, cron_expr* expr, cron_day_cache* cache, int dom, uint8_t* resets, int offset) {
+    int month = calendar->tm_mon, year = calendar->tm_year, day = dom, count, max = 12 * (CRON_MAX_YEARS_DIFF + 1);
+    uint32_t mask;
+    for (count = 0; count < max; count++) {
+        mask = cached_day_mask(expr, cache, month, year);
+        for (; day > 0 && day < 32 && !(mask >> day & 1); day += offset);
+        if (day > 0 && day < 32) break;
+        /* no matching days left in the month, continue with the next/previous one */
+        if (offset > 0) {
+            if (++month == 12) { month = 0; year++; }
+            day = 1;
+        } else {
+            if (--month < 0) { month = 11; year--; }
+            day = 31;
+        }
+    }
+    /* rule never matches */
+    if (count == max) return -1;
+    if (!count && day == dom) return dom;
+    if (offset > 0) reset_all_min(calendar, resets) else reset_all_max(calendar, resets);
+    calendar->tm_year = year;
+    calendar->tm_mon = month;
+    calendar->tm_mday = day;
+    calendar->tm_isdst = -1;
+    MKTIME(calendar, tz);
+    return calendar->tm_mday; return_error: return -1;
 }
 
-static int find_day(struct tm* calendar, uint8_t* days_of_month, int8_t* dim, int dom, uint8_t* days_of_week, int dow, uint8_t* flags, uint8_t* resets, int offset) {
-    int day = -1, year = calendar->tm_year, month = calendar->tm_mon;
+static int find_day(struct tm* calendar, const cron_tz* tz, cron_expr* expr, cron_day_cache* cache, int dom, int dow, uint8_t* resets, int offset) {
     unsigned int count = 0, max = 366;
-    while (find_day_condition(calendar, days_of_month, dim, dom, days_of_week, dow, flags, &day) && count++ < max) {
+    if (*expr->flags || *expr->day_in_month) return find_day_masked(calendar, tz, expr, cache, dom, resets, offset);
+    while (find_day_condition(calendar, expr, cache, dom, dow) && count++ < max) {
         if (offset > 0) reset_all_min(calendar, resets) else reset_all_max(calendar, resets);
-        add_to_field(calendar, CRON_CF_DAY_OF_MONTH, offset); MKTIME(calendar);
+        add_to_field(calendar, CRON_CF_DAY_OF_MONTH, offset); MKTIME(calendar, tz);
         dom = calendar->tm_mday;
         dow = calendar->tm_wday;
-        if (year != calendar->tm_year) {
-            year = calendar->tm_year;
-            day = -1; /* This should not be needed unless there is as single day month in libc. */
-        }
-        if (month != calendar->tm_mon) {
-            month = calendar->tm_mon;
-            day = -1;
-        }
     }
     return dom; return_error: return -1;
 }
 
 #define RI(field, expr_field, min, max, nextField) \
-        value = *get_field_ptr(calendar, field); update_value = find_nextprev(expr_field, max, value, min, calendar, field, nextField, resets, offset);
-#define RF(field) if (update_value < 0) break; if (value == update_value) cron_set_bit(resets, field)
+        value = *get_field_ptr(calendar, field); update_value = find_nextprev(expr_field, max, value, min, calendar, tz, field, nextField, resets, offset);
+/* field is reset by the change of any higher one, also when it has just moved itself, an unchanged field falls through to the next one */
+#define RF(field) if (update_value < 0) break; cron_set_bit(resets, field); if (value == update_value) (void) 0
 
-static int do_nextprev(cron_expr* expr, struct tm* calendar, int dot, int offset) {
-    int value = 0, update_value = 0;
+static int do_nextprev(cron_expr* expr, struct tm* calendar, const cron_tz* tz, cron_day_cache* cache, int dot, int offset) {
+    int value = 0, update_value = 0, month;
     uint8_t resets[1];
 
     for(;;) {
@@ -570,8 +868,10 @@ static int do_nextprev(cron_expr* expr, struct tm* calendar, int dot, int offset
         RI(CRON_CF_HOUR_OF_DAY,   expr->hours,   0, CRON_MAX_HOURS,                           CRON_CF_DAY_OF_MONTH);
         RF(CRON_CF_HOUR_OF_DAY);  else continue;
         value = *get_field_ptr(calendar,            CRON_CF_DAY_OF_MONTH);
-        update_value = find_day(calendar,
-                expr->days_of_month, expr->day_in_month, value, expr->days_of_week, calendar->tm_wday, expr->flags, resets, offset);
+        month = calendar->tm_year * 12 + calendar->tm_mon;
+        update_value = find_day(calendar, tz, expr, cache, value, calendar->tm_wday, resets, offset);
+        /* the same day of another month is a change too, lower fields are reset by find_day() and must be searched again */
+        if (month != calendar->tm_year * 12 + calendar->tm_mon) value = -1;
         RF(CRON_CF_DAY_OF_MONTH); else continue;
         RI(CRON_CF_MONTH,         expr->months, 0, CRON_MAX_MONTHS,                           CRON_CF_YEAR);
         if (update_value < 0) break;
@@ -675,7 +975,7 @@ int cron_generate_expr(cron_expr *source, char *buffer, int buffer_len, int cron
     return len;
 }
 
-static time_t cron(cron_expr* expr, time_t date, int offset) {
+static time_t cron(cron_expr* expr, const cron_tz* tz, time_t date, int offset) {
     /*
      The plan:
 
@@ -694,29 +994,53 @@ static time_t cron(cron_expr* expr, time_t date, int offset) {
 
      ...
      */
-    struct tm calval, *calendar;
+    struct tm calval;
+    cron_day_cache cache;
+    struct tm* calendar;
     time_t original, calculated;
     if (!expr) goto return_error;
-    memset(&calval, 0, sizeof(struct tm));
-    calendar = cron_time(&date, &calval);
+    memset(&calval, 0, sizeof(calval));
+    memset(&cache, 0, sizeof(cache));
+    calendar = tz ? tz_localtime(date, tz, &calval) : cron_time(&date, &calval);
     if (!calendar) goto return_error;
-    original = cron_mktime(calendar);
+    original = calendar_mktime(calendar, tz);
     if (CRON_INVALID_INSTANT == original) goto return_error;
-    if (0 != do_nextprev(expr, calendar, calendar->tm_year, offset)) goto return_error;
-    calculated = cron_mktime(calendar);
+    if (0 != do_nextprev(expr, calendar, tz, &cache, calendar->tm_year, offset)) goto return_error;
+    calculated = calendar_mktime(calendar, tz);
     if (CRON_INVALID_INSTANT == calculated) goto return_error;
     if (calculated == original) {
         /* We arrived at the original timestamp - round up to the next whole second and try again... */
-        add_to_field(calendar, CRON_CF_SECOND, offset); MKTIME(calendar);
-        if (0 != do_nextprev(expr, calendar, calendar->tm_year, offset)) goto return_error;
+        add_to_field(calendar, CRON_CF_SECOND, offset); MKTIME(calendar, tz);
+        if (0 != do_nextprev(expr, calendar, tz, &cache, calendar->tm_year, offset)) goto return_error;
     }
 
-    return cron_mktime(calendar);
+    return calendar_mktime(calendar, tz);
     return_error: return CRON_INVALID_INSTANT;
 }
 
+/**
+ * Expand '@' macro, returns NULL for unknown macros.
+ */
+static const char* expand_macro(const char* name, size_t len) {
+#define CRON_MACRO(macro, expr) if (len == sizeof(macro) - 1 && !memcmp(name, macro, len)) return expr
+    switch (len ? *name : '\0') {
+    case 'a': CRON_MACRO("annually", "0 0 0 1 1 *");   break;
+    case 'y': CRON_MACRO("yearly",   "0 0 0 1 1 *");   break;
+    case 'm': CRON_MACRO("monthly",  "0 0 0 1 * *");
+              CRON_MACRO("midnight", "0 0 0 * * *");
+              CRON_MACRO("minutely", "0 * * * * *");   break;
+    case 'w': CRON_MACRO("weekly",   "0 0 0 * * 0");   break;
+    case 'd': CRON_MACRO("daily",    "0 0 0 * * *");   break;
+    case 'h': CRON_MACRO("hourly",   "0 0 * * * *");   break;
+    case 's': CRON_MACRO("secondly", "* * * * * * *"); break;
+    }
+#undef CRON_MACRO
+    return NULL;
+}
+
 void cron_parse_expr(const char* expression, cron_expr* target, const char** error) {
     const char* err_local;
+    const char* macro;
     int len = 0;
     ParserContext context;
     if (!error) error = &err_local;
@@ -725,25 +1049,308 @@ void cron_parse_expr(const char* expression, cron_expr* target, const char** err
     if (!target)                                                                CRON_ERROR("Invalid NULL target");
     if ('@' == *expression) {
         expression++;
-             if (!strcmp("annually", expression) || !strcmp("yearly", expression))   expression = "0 0 0 1 1 *";
-        else if (!strcmp("monthly",  expression))                                    expression = "0 0 0 1 * *";
-        else if (!strcmp("weekly",   expression))                                    expression = "0 0 0 * * 0";
-        else if (!strcmp("daily",    expression) || !strcmp("midnight", expression)) expression = "0 0 0 * * *";
-        else if (!strcmp("hourly",   expression))                                    expression = "0 0 * * * *";
-        else if (!strcmp("minutely", expression))                                    expression = "0 * * * * *";
-        else if (!strcmp("secondly", expression))                                    expression = "* * * * * * *";
-        else if (!strcmp("reboot",   expression))                           CRON_ERROR("@reboot not implemented");
+        if (!strcmp("reboot", expression))                                  CRON_ERROR("@reboot not implemented");
+        macro = expand_macro(expression, strlen(expression));
+        if (macro) expression = macro;
     }
     len = count_fields(expression, ' ');
     if (len < 5 || len > 7) CRON_ERROR("Invalid number of fields, expression must consist of 5-7 fields");
     memset(target, 0, sizeof(*target));
     memset(&context, 0, sizeof(context));
     context.input = expression;
+    context.end = expression + strlen(expression);
     context.target = target;
     Fields(&context, len);
     *error = context.err;
     error: return;
 }
 
-time_t cron_next(cron_expr* expr, time_t date) { return cron(expr, date, +1); }
-time_t cron_prev(cron_expr* expr, time_t date) { return cron(expr, date, -1); }
+void cron_parse_expr_n(const char* expression, size_t length, cron_expr* target, const char** error) {
+    const char* err_local;
+    const char* end;
+    int separators = 0;
+    uint16_t tokens[CRON_PARSE_TOKENS];
+    ParserContext context;
+    if (!error) error = &err_local;
+    *error = NULL;
+    if (!expression)                                                        CRON_ERROR("Invalid NULL expression");
+    if (!target)                                                                CRON_ERROR("Invalid NULL target");
+    end = expression + length;
+    /* trim the slice */
+    while (expression != end && isspace(*expression)) expression++;
+    while (end != expression && isspace(end[-1])) end--;
+    if (expression == end)                  CRON_ERROR("Invalid number of fields, expression must consist of 5-7 fields");
+    if (expression != end && '@' == *expression) {
+        expression++;
+        if (end - expression == 6 && !memcmp("reboot", expression, 6))     CRON_ERROR("@reboot not implemented");
+        expression = expand_macro(expression, (size_t)(end - expression));
+        if (!expression)                                                    CRON_ERROR("Invalid '@' macro");
+        end = expression + strlen(expression);
+    }
+    memset(target, 0, sizeof(*target));
+    memset(&context, 0, sizeof(context));
+    context.input = expression;
+    context.end = end;
+    context.target = target;
+    context.tokens = tokens;
+    /* tokenize till the sixth field starts, an expression that ends earlier with 5 fields has no seconds field */
+    do {
+        token_read(&context);
+        /* numbers out of any field's range are kept as 4095, those fail the same way */
+        if (context.ntokens < CRON_PARSE_TOKENS)
+            tokens[context.ntokens] = (uint16_t)(((unsigned)context.value > 4095 ? 4095 : (unsigned)context.value) << 4 | context.type);
+        context.ntokens++;
+        separators += T_WS == context.type;
+    } while (T_EOF != context.type && separators < 5);
+    context.err = NULL;
+    if (context.ntokens > CRON_PARSE_TOKENS) {
+        /* too many tokens to keep, read the text from the start */
+        context.input = expression;
+        context.ntokens = 0;
+    }
+    /* parse the recorded tokens, the text is read on from where tokenizer stopped */
+    FieldsRecorded(&context, T_EOF == context.type && 4 == separators);
+    *error = context.err;
+    error: return;
+}
+
+time_t cron_next(cron_expr* expr, time_t date) { return cron(expr, NULL, date, +1); }
+time_t cron_prev(cron_expr* expr, time_t date) { return cron(expr, NULL, date, -1); }
+time_t cron_next_tz(cron_expr* expr, const cron_tz* tz, time_t date) { return tz ? cron(expr, tz, date, +1) : CRON_INVALID_INSTANT; }
+time_t cron_prev_tz(cron_expr* expr, const cron_tz* tz, time_t date) { return tz ? cron(expr, tz, date, -1) : CRON_INVALID_INSTANT; }
+
+struct tm* cron_time_tz(time_t date, const cron_tz* tz, struct tm* out) {
+    return tz && out ? tz_localtime(date, tz, out) : NULL;
+}
+
+void cron_parse_tz(const char* tz, cron_tz* target, const char** error) {
+    const char* err_local;
+    const char* s;
+    int32_t offset;
+    if (!error) error = &err_local;
+    *error = NULL;
+    if (!target)                                                            CRON_ERROR("Invalid NULL target");
+    memset(target, 0, sizeof(*target));
+    if (!tz || !(s = tz_name(tz)))                                          CRON_ERROR("Invalid TZ name");
+    if (!(s = tz_time(s, &offset)))                                         CRON_ERROR("Invalid TZ offset");
+    /* POSIX offsets are positive west of Greenwich */
+    target->std_offset = target->dst_offset = -offset;
+    if (!*s) return;
+    if (!(s = tz_name(s)))                                                  CRON_ERROR("Invalid TZ name");
+    target->dst_offset = target->std_offset + 3600;
+    if (*s && ',' != *s) {
+        if (!(s = tz_time(s, &offset)))                                     CRON_ERROR("Invalid TZ offset");
+        target->dst_offset = -offset;
+    }
+    /* default rule, same as glibc uses */
+    if (!*s) s = ",M3.2.0,M11.1.0";
+    if (',' != *s || !(s = tz_transition(s + 1, &target->start))
+        || ',' != *s || !(s = tz_transition(s + 1, &target->end)) || *s) CRON_ERROR("Invalid TZ rule");
+    target->has_dst = 1;
+    return;
+    error: if (target) memset(target, 0, sizeof(*target));
+}
+
+static int count_set_bits(uint8_t* bits, int from, int to) {
+    int count = 0;
+    for (; from < to; from++) if (cron_get_bit(bits, from)) count++;
+    return count;
+}
+
+/**
+ * Count matching seconds of the day that are below the 'sod' second of the day (0..DAY_SECONDS).
+ */
+static int64_t count_day_seconds(cron_expr* expr, int sod, int per_minute, int per_hour) {
+    int hour = sod / 3600, minute = sod % 3600 / 60, second = sod % 60;
+    int64_t count = (int64_t)count_set_bits(expr->hours, 0, hour) * per_hour;
+    if (hour < CRON_MAX_HOURS && cron_get_bit(expr->hours, hour)) {
+        count += count_set_bits(expr->minutes, 0, minute) * per_minute;
+        if (cron_get_bit(expr->minutes, minute)) count += count_set_bits(expr->seconds, 0, second);
+    }
+    return count;
+}
+
+static int match_day(cron_expr* expr, cron_day_cache* cache, struct tm* calendar) {
+#ifndef CRON_DISABLE_YEARS
+    int year = calendar->tm_year + YEAR_OFFSET;
+    if (!cron_get_bit(expr->years, EXPR_YEARS_LENGTH*8-1) &&
+        (year < CRON_MIN_YEARS || year >= CRON_MAX_YEARS || !cron_get_bit(expr->years, year - CRON_MIN_YEARS))) return 0;
+#endif
+    if (!cron_get_bit(expr->months, calendar->tm_mon)) return 0;
+    return !find_day_condition(calendar, expr, cache, calendar->tm_mday, calendar->tm_wday);
+}
+
+static void reset_day(struct tm* calendar) {
+    calendar->tm_hour = calendar->tm_min = calendar->tm_sec = 0;
+    calendar->tm_isdst = -1;
+}
+
+/**
+ * Walk the calendar days of the range, counting 'fire' dates or writing them to the buffer if one is provided.
+ */
+static int64_t cron_between(cron_expr* expr, time_t date_from, time_t date_to, time_t* buffer, int buffer_len) {
+    struct tm calval, nextval, *calendar;
+    cron_day_cache cache;
+    time_t day_start, next_start, from, to, date;
+    int per_minute, per_hour, hour, minute, second;
+    int64_t count = 0;
+    if (!expr || (buffer && buffer_len < 0)) goto return_error;
+    if (date_from >= date_to) return 0;
+    per_minute = count_set_bits(expr->seconds, 0, CRON_MAX_SECONDS);
+    per_hour = count_set_bits(expr->minutes, 0, CRON_MAX_MINUTES) * per_minute;
+    memset(&calval, 0, sizeof(struct tm));
+    memset(&cache, 0, sizeof(cache));
+    calendar = cron_time(&date_from, &calval);
+    if (!calendar) goto return_error;
+    reset_day(calendar);
+    day_start = cron_mktime(calendar);
+    if (CRON_INVALID_INSTANT == day_start) goto return_error;
+
+    while (day_start < date_to) {
+        nextval = *calendar;
+        /* skip the rest of the month at once if it does not match */
+        if (cron_get_bit(expr->months, calendar->tm_mon)) nextval.tm_mday++;
+        else { nextval.tm_mday = 1; nextval.tm_mon++; }
+        reset_day(&nextval);
+        next_start = cron_mktime(&nextval);
+        if (CRON_INVALID_INSTANT == next_start) goto return_error;
+        if (match_day(expr, &cache, calendar)) {
+            from = date_from > day_start ? date_from : day_start;
+            to = date_to < next_start ? date_to : next_start;
+            if (next_start - day_start != DAY_SECONDS) {
+                /* DST transition within a day, iterate it with cron_next() from the previous 'fire' date, the same way
+                   a chain of cron_next() calls reaches it, ambiguous times of a fall-back are resolved the same way then */
+                date = cron_prev(expr, from);
+                for (date = cron_next(expr, CRON_INVALID_INSTANT != date ? date : from - 1); CRON_INVALID_INSTANT != date && date < to; date = cron_next(expr, date)) {
+                    if (date < from) continue;
+                    if (buffer) {
+                        if (count == buffer_len) return count;
+                        buffer[count] = date;
+                    }
+                    count++;
+                }
+            } else if (buffer) {
+                for (hour = next_set_bit(expr->hours, CRON_MAX_HOURS, (int)(from - day_start) / 3600); hour >= 0; hour = next_set_bit(expr->hours, CRON_MAX_HOURS, hour + 1))
+                for (minute = next_set_bit(expr->minutes, CRON_MAX_MINUTES, 0); minute >= 0; minute = next_set_bit(expr->minutes, CRON_MAX_MINUTES, minute + 1))
+                for (second = next_set_bit(expr->seconds, CRON_MAX_SECONDS, 0); second >= 0; second = next_set_bit(expr->seconds, CRON_MAX_SECONDS, second + 1)) {
+                    date = day_start + hour * 3600 + minute * 60 + second;
+                    if (date < from) continue;
+                    if (date >= to) goto day_done;
+                    if (count == buffer_len) return count;
+                    buffer[count++] = date;
+                }
+                day_done: ;
+            } else {
+                count += count_day_seconds(expr, (int)(to - day_start), per_minute, per_hour)
+                       - count_day_seconds(expr, (int)(from - day_start), per_minute, per_hour);
+            }
+        }
+        *calendar = nextval;
+        day_start = next_start;
+    }
+    return count;
+    return_error: return -1;
+}
+
+int64_t cron_count_between(cron_expr* expr, time_t date_from, time_t date_to) {
+    return cron_between(expr, date_from, date_to, NULL, 0);
+}
+
+int cron_enumerate_between(cron_expr* expr, time_t date_from, time_t date_to, time_t* buffer, int buffer_len) {
+    if (!buffer) return -1;
+    return (int)cron_between(expr, date_from, date_to, buffer, buffer_len);
+}
+
+/**
+ * Pack bytes of the bitset into a word, bit positions are kept.
+ */
+static uint64_t bytes_to_word(const uint8_t* bytes, int len) {
+    uint64_t word = 0;
+    while (len--) word = word << 8 | bytes[len];
+    return word;
+}
+
+static void word_to_bytes(uint64_t word, uint8_t* bytes, int len) {
+    int i;
+    for (i = 0; i < len; i++, word >>= 8) bytes[i] = (uint8_t) word;
+}
+
+void cron_expr_to_v2(const cron_expr* source, cron_expr_v2* target) {
+#ifndef CRON_DISABLE_YEARS
+    int i, len;
+#endif
+    if (!source || !target) return;
+    memset(target, 0, sizeof(*target));
+    target->seconds       = bytes_to_word(source->seconds, sizeof(source->seconds));
+    target->minutes       = bytes_to_word(source->minutes, sizeof(source->minutes));
+    target->hours         = (uint32_t) bytes_to_word(source->hours, sizeof(source->hours));
+    target->days_of_month = (uint32_t) bytes_to_word(source->days_of_month, sizeof(source->days_of_month));
+    target->months        = (uint16_t) bytes_to_word(source->months, sizeof(source->months));
+    target->days_of_week  = source->days_of_week[0];
+    target->flags         = (uint32_t) (source->flags[0] & 7) | (uint32_t) (uint8_t) source->day_in_month[0] << 8;
+#ifndef CRON_DISABLE_YEARS
+    for (i = 0; i < EXPR_YEARS_LENGTH; i += 8) {
+        len = EXPR_YEARS_LENGTH - i < 8 ? EXPR_YEARS_LENGTH - i : 8;
+        target->years[i / 8] = bytes_to_word(source->years + i, len);
+    }
+#endif
+}
+
+void cron_expr_from_v2(const cron_expr_v2* source, cron_expr* target) {
+#ifndef CRON_DISABLE_YEARS
+    int i, len;
+#endif
+    if (!source || !target) return;
+    memset(target, 0, sizeof(*target));
+    word_to_bytes(source->seconds, target->seconds, sizeof(target->seconds));
+    word_to_bytes(source->minutes, target->minutes, sizeof(target->minutes));
+    word_to_bytes(source->hours, target->hours, sizeof(target->hours));
+    word_to_bytes(source->days_of_month, target->days_of_month, sizeof(target->days_of_month));
+    word_to_bytes(source->months, target->months, sizeof(target->months));
+    target->days_of_week[0] = source->days_of_week;
+    target->flags[0]        = (uint8_t) (source->flags & 7);
+    target->day_in_month[0] = CRON_V2_DAY_IN_MONTH(source->flags);
+#ifndef CRON_DISABLE_YEARS
+    for (i = 0; i < EXPR_YEARS_LENGTH; i += 8) {
+        len = EXPR_YEARS_LENGTH - i < 8 ? EXPR_YEARS_LENGTH - i : 8;
+        word_to_bytes(source->years[i / 8], target->years + i, len);
+    }
+#endif
+}
+
+/**
+ * Same as find_day_condition() for the word aligned layout, returns 1 if day matches.
+ */
+static int match_day_v2(const cron_expr_v2* expr, const struct tm* calendar) {
+    int flags = (int) (expr->flags & 7), dim = CRON_V2_DAY_IN_MONTH(expr->flags), dom = calendar->tm_mday, day;
+    if (!CRON_V2_HAS(expr->days_of_month, dom) || !CRON_V2_HAS(expr->days_of_week, calendar->tm_wday)) return 0;
+    if (!flags && !dim) return 1;
+    day = special_day(flags, dim, calendar->tm_mon, calendar->tm_year);
+    if (flags) {
+        if ((flags & 3) && dom != day+1+dim)                                                 return 0;
+        if ((flags & 4) && dom != day)                                                       return 0;
+    } else {
+        if (dim < 0 && (dom < day+WEEK_DAYS*dim+1 || dom >= day+WEEK_DAYS*(dim+1)+1))        return 0;
+        if (dim > 0 && (dom < WEEK_DAYS*(dim-1)+1 || dom >= WEEK_DAYS*dim+1))                return 0;
+    }
+    return 1;
+}
+
+int cron_match_v2(const cron_expr_v2* expr, const struct tm* calendar) {
+#ifndef CRON_DISABLE_YEARS
+    int year;
+#endif
+    if (!expr || !calendar) return 0;
+    if (calendar->tm_sec < 0 || calendar->tm_sec > 61 || !CRON_V2_HAS(expr->seconds, calendar->tm_sec)) return 0;
+    if (calendar->tm_min < 0 || calendar->tm_min > 59 || !CRON_V2_HAS(expr->minutes, calendar->tm_min)) return 0;
+    if (calendar->tm_hour < 0 || calendar->tm_hour > 23 || !CRON_V2_HAS(expr->hours, calendar->tm_hour)) return 0;
+    if (calendar->tm_mon < 0 || calendar->tm_mon > 11 || !CRON_V2_HAS(expr->months, calendar->tm_mon)) return 0;
+    if (calendar->tm_mday < 1 || calendar->tm_mday > 31 || calendar->tm_wday < 0 || calendar->tm_wday > 6) return 0;
+#ifndef CRON_DISABLE_YEARS
+    /* last bit stands for any year */
+    year = calendar->tm_year + YEAR_OFFSET - CRON_MIN_YEARS;
+    if (!CRON_V2_HAS(expr->years[(EXPR_YEARS_LENGTH*8-1) / 64], (EXPR_YEARS_LENGTH*8-1) % 64) &&
+        (year < 0 || year >= CRON_MAX_YEARS - CRON_MIN_YEARS || !CRON_V2_HAS(expr->years[year / 64], year % 64))) return 0;
+#endif
+    return match_day_v2(expr, calendar);
+}
@@ -74,6 +74,78 @@ typedef struct {
 #endif
 } cron_expr;
 
+/**
+ * Parsed cron expression, word aligned layout
+ *
+ * Every field is a naturally aligned mask, bit n is set when value n matches,
+ * so membership is a single shift and mask, see CRON_V2_HAS().
+ * Bit positions are the same as in cron_expr: days of month use bits 1-31,
+ * months bits 0-11, days of week bits 0-6 (0 is Sunday), seconds bits 60-61
+ * are leap seconds and years bit n stands for year 1970 + n.
+ * Note: it is not smaller than cron_expr, 32 bytes vs 28 (64 vs 57 with years),
+ * aligned words need padding. CronoS tasks keep cron_expr, a task there takes
+ * several times the size of the rule anyway, see CronoS::footprint().
+ */
+
+typedef struct {
+    uint64_t seconds;
+    uint64_t minutes;
+    uint32_t hours;
+    uint32_t days_of_month;
+    uint16_t months;
+    uint8_t  days_of_week;
+    uint8_t  reserved;
+    /**
+     * Flags:
+     * bits 0-2  same as cron_expr flags, see CRON_V2_LAST_DAY and others
+     * bits 8-15 day_in_month as signed byte, see CRON_V2_DAY_IN_MONTH()
+     */
+    uint32_t flags;
+#ifndef CRON_DISABLE_YEARS
+    uint64_t years[(EXPR_YEARS_LENGTH + 7) / 8];
+#endif
+} cron_expr_v2;
+
+#define CRON_V2_LAST_DAY            0x01 /* 'L' in day of month */
+#define CRON_V2_LAST_WEEKDAY        0x02 /* 'LW' in day of month */
+#define CRON_V2_CLOSEST_WEEKDAY     0x04 /* 'W' in day of month */
+#define CRON_V2_DAY_IN_MONTH(flags) ((int8_t) (((flags) >> 8) & 0xff))
+#define CRON_V2_HAS(mask, idx)      (((mask) >> (idx)) & 1)
+
+/**
+ * Daylight saving time transition of POSIX TZ rule
+ */
+
+typedef struct {
+    /**
+     * Transition day:
+     * 'M' month, week (5 is the last one) and day of week (0 is Sunday)
+     * 'J' julian day 1-365, February 29 is never counted
+     * 'D' zero based day of year 0-365
+     */
+    uint8_t type;
+    uint8_t month;
+    uint8_t week;
+    uint8_t wday;
+    int16_t day;
+    /* local time of the transition, seconds since midnight, could be negative or over 24 hours */
+    int32_t time;
+} cron_tz_transition;
+
+/**
+ * Timezone compiled from POSIX TZ string, see cron_parse_tz()
+ */
+
+typedef struct {
+    /* offsets from UTC in seconds, positive east of Greenwich */
+    int32_t std_offset;
+    int32_t dst_offset;
+    /* DST start in standard time and DST end in daylight saving time */
+    cron_tz_transition start;
+    cron_tz_transition end;
+    uint8_t has_dst;
+} cron_tz;
+
 /**
  * Parses specified cron expression.
  *
@@ -87,6 +159,27 @@ typedef struct {
  */
 void cron_parse_expr(const char* expression, cron_expr* target, const char** error);
 
+/**
+ * Parses specified cron expression given as a slice of a larger buffer.
+ * Expression is tokenized once and never read past the given length, so it does not need
+ * to be nul-terminated. Tokens of the first five fields are kept till it is known whether
+ * the seconds field is present, expressions with more than 128 tokens in those fields are
+ * read twice.
+ * Unlike cron_parse_expr(), which takes fields separated by spaces only and rejects
+ * leading whitespace, fields could be separated by any whitespace, and leading and
+ * trailing whitespaces are ignored, so a line of a crontab could be passed as is.
+ * Valid expressions without surrounding whitespace are parsed the same by both.
+ *
+ * @param expression cron expression
+ * @param length expression length
+ * @param pointer to cron expression structure, it's client code responsibility
+ *        to free/destroy it afterwards
+ * @param error output error message, will be set to string literal
+ *        error message in case of error. Will be set to NULL on success.
+ *        The error message should NOT be freed by client.
+ */
+void cron_parse_expr_n(const char* expression, size_t length, cron_expr* target, const char** error);
+
 /**
  * Uses the specified expression to calculate the next 'fire' date after
  * the specified date. All dates are processed as UTC (GMT) dates
@@ -111,6 +204,113 @@ time_t cron_next(cron_expr* expr, time_t date);
  */
 time_t cron_prev(cron_expr* expr, time_t date);
 
+/**
+ * Parses POSIX TZ string, e.g. "CET-1CEST,M3.5.0,M10.5.0/3" or "<+0530>-5:30",
+ * into a timezone rule to be used with cron_next_tz() and cron_prev_tz().
+ * Zone names from tz database (e.g. "Europe/Berlin") are not supported.
+ * If DST rule is omitted, US rule "M3.2.0,M11.1.0" is assumed same as glibc does.
+ *
+ * @param tz POSIX TZ string
+ * @param target timezone rule
+ * @param error output error message, will be set to string literal
+ *        error message in case of error. Will be set to NULL on success.
+ */
+void cron_parse_tz(const char* tz, cron_tz* target, const char** error);
+
+/**
+ * Same as cron_next() with dates processed in the given timezone, no matter
+ * how the library is compiled. Does not use the process-wide timezone (TZ), so
+ * expressions in different timezones could be evaluated concurrently.
+ *
+ * @param expr parsed cron expression to use in next date calculation
+ * @param tz timezone rule, see cron_parse_tz()
+ * @param date start date to start calculation from
+ * @return next 'fire' date in case of success, '((time_t) -1)' in case of error.
+ */
+time_t cron_next_tz(cron_expr* expr, const cron_tz* tz, time_t date);
+
+/**
+ * Same as cron_prev() with dates processed in the given timezone, see cron_next_tz().
+ *
+ * @param expr parsed cron expression to use in previous date calculation
+ * @param tz timezone rule, see cron_parse_tz()
+ * @param date start date to start calculation from
+ * @return previous 'fire' date in case of success, '((time_t) -1)' in case of error.
+ */
+time_t cron_prev_tz(cron_expr* expr, const cron_tz* tz, time_t date);
+
+/**
+ * Converts date to the broken-down time in the given timezone, same as localtime_r().
+ *
+ * @param date date to convert
+ * @param tz timezone rule, see cron_parse_tz()
+ * @param out broken-down time
+ * @return 'out' in case of success, NULL in case of error.
+ */
+struct tm* cron_time_tz(time_t date, const cron_tz* tz, struct tm* out);
+
+/**
+ * Counts 'fire' dates of the expression within the [date_from, date_to) range.
+ * Counts are calculated from the fields bitsets per each matching day instead
+ * of iterating over every 'fire' date, days with DST transitions (when compiled
+ * with '-DCRON_USE_LOCAL_TIME') are counted by iterating with cron_next().
+ * Those days are iterated from the previous 'fire' date, so a time repeated by
+ * a DST fall-back is resolved the same way as by a chain of cron_next() calls
+ * that reaches the day. A chain that starts within the day of a fall-back may
+ * resolve it differently, as mktime() picks either occurrence of the time.
+ * Leap seconds positions ('L' in seconds field) are not counted.
+ *
+ * @param expr parsed cron expression
+ * @param date_from start of the range (inclusive)
+ * @param date_to end of the range (exclusive)
+ * @return number of 'fire' dates in the range, -1 in case of error.
+ */
+int64_t cron_count_between(cron_expr* expr, time_t date_from, time_t date_to);
+
+/**
+ * Enumerates 'fire' dates of the expression within the [date_from, date_to) range
+ * writing them in ascending order to the caller provided buffer, the dates are
+ * the ones counted by cron_count_between().
+ * If the buffer gets full the enumeration stops, to continue call again with
+ * 'date_from' set to the last returned date + 1.
+ *
+ * @param expr parsed cron expression
+ * @param date_from start of the range (inclusive)
+ * @param date_to end of the range (exclusive)
+ * @param buffer buffer for the result
+ * @param buffer_len maximum number of dates to write to the buffer
+ * @return number of dates written to the buffer, -1 in case of error.
+ */
+int cron_enumerate_between(cron_expr* expr, time_t date_from, time_t date_to, time_t* buffer, int buffer_len);
+
+/**
+ * Converts parsed cron expression to the word aligned layout.
+ *
+ * @param source parsed cron expression
+ * @param target word aligned cron expression
+ */
+void cron_expr_to_v2(const cron_expr* source, cron_expr_v2* target);
+
+/**
+ * Converts word aligned cron expression back to the byte layout,
+ * e.g. to be used with cron_next() or cron_generate_expr().
+ *
+ * @param source word aligned cron expression
+ * @param target parsed cron expression
+ */
+void cron_expr_from_v2(const cron_expr_v2* source, cron_expr* target);
+
+/**
+ * Checks if the calendar date matches the expression.
+ * The calendar should be normalized (as returned by gmtime()/localtime()),
+ * 'tm_wday' is used for the day of week match.
+ *
+ * @param expr word aligned cron expression
+ * @param calendar date to check
+ * @return 1 if the date matches, 0 if not.
+ */
+int cron_match_v2(const cron_expr_v2* expr, const struct tm* calendar);
+
 /**
  * Generate cron expression from cron_expr structure
  *
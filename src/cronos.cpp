@@ -11,19 +11,238 @@ GitHub: https://github.com/vortigont/pzem-edl
 */
 #include "cronos.hpp"
 #include <ctime>
+#include <algorithm>
+#include <cstring>
+#include <cctype>
+#include <chrono>
+#include <sys/time.h>
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/timerfd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <cerrno>
+#endif
+#ifdef ESP_PLATFORM
+#include "esp_log.h"
+#include "esp_timer.h"
+#endif
 //#include "Arduino.h"
 
-#define DEFAULT_RESCHEDULING_TIME   1000  // millseconds
+#ifndef DEFAULT_RESCHEDULING_TIME
+#define DEFAULT_RESCHEDULING_TIME   1000  // millseconds, max time between evaluations, scheduler wakes up earlier if some task is due
+                                          // power-constrained setups could increase it to have less wakeups, then reload() MUST be called on time adjustments
+#endif
 #define CRONOS_TASK_MAX_LATE_TIME   3     // seconds, when evaluating tasks, consider this value as max late threshold for task to run
                                           // if current time differentce with tasks next_run time is larger than that, skip task's run as too late
                                           // this value is threshold for situations like time skew adjustment or too long scheduler run for some reason
 
+#ifndef CRONOS_RELOAD_CHUNK
+#define CRONOS_RELOAD_CHUNK         32    // number of tasks recalculated per scheduler run after reload()
+#endif
+#define CRONOS_RELOAD_HORIZON       5     // seconds, tasks that fire within this time are recalculated by reload() right away
+#ifndef CRONOS_PLAN_TASK_MAX
+#define CRONOS_PLAN_TASK_MAX        1440  // max fires per day for a task to be put into the daily plan, denser tasks are evaluated live
+#endif
+
 static constexpr const char* tag = "CronoS";
 
+// scheduler trace, compiled out unless built with -DCRONOS_TRACE
+#ifdef CRONOS_TRACE
+#define CRONOS_TRACE_EVENT(event, id, value)  _trace(CronoS_TraceEvent::event, id, value)
+static_assert((CRONOS_TRACE_SIZE & (CRONOS_TRACE_SIZE - 1)) == 0, "CRONOS_TRACE_SIZE must be a power of 2");
+#else
+#define CRONOS_TRACE_EVENT(event, id, value)
+#endif
+
+// trace dump format
+#define CRONOS_TRACE_MAGIC          0x52545243  // "CRTR"
+#define CRONOS_TRACE_VERSION        1
+
+struct cronos_trace_header_t {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t entry_size;
+  uint32_t count;
+};
+
+// binary image format
+#define CRONOS_IMAGE_MAGIC          0x534e5243  // "CRNS"
+#define CRONOS_IMAGE_VERSION        9
+
+struct cronos_image_header_t {
+  uint32_t magic;
+  uint16_t version;
+  // size of entry struct, varies with build options for cron_expr
+  uint16_t entry_size;
+  uint32_t count;
+  // last generated task id, the shared counter of CronoS_Sharded if the scheduler is a shard
+  uint32_t cnt;
+  // sizes of raw cron_expr and cron_tz structs in the entries, those vary with ccronexpr build options
+  uint16_t expr_size;
+  uint16_t tz_size;
+  // checksum of the entries
+  uint32_t sum;
+};
+
+// run state blob format
+#define CRONOS_STATE_MAGIC          0x32534e43  // "CNS2", 64 bit next run times
+
+struct cronos_state_header_t {
+  uint32_t magic;
+  uint32_t count;
+  // checksum of the entries
+  uint32_t sum;
+};
+
+struct cronos_state_entry_t {
+  // time_t might be 32 or 64 bit, saved as 64 bit
+  int64_t next_run;
+  cronos_tid id;
+  uint32_t runs;
+};
+
+struct cronos_image_entry_t {
+  int64_t next_run;
+  cronos_tid id;
+  uint32_t spread;
+  uint32_t slack;
+  uint16_t offset_ms;
+  uint8_t valid;
+  uint8_t priority;
+  uint32_t budget_ms;
+  uint8_t overlap;
+  uint8_t max_inflight;
+  uint8_t has_tz;
+  uint8_t max_overruns;
+  uint8_t disabled;
+  uint8_t overruns;
+  uint8_t demoted;
+  uint32_t run_budget_us;
+  uint32_t runs;
+  cronos_gid group;
+  cron_tz tz;
+  cron_expr rule;
+};
+
+// a stable hash of task id to derive spread offsets (murmur3 finalizer)
+static uint32_t cronos_hash(cronos_tid id){
+  id ^= id >> 16;
+  id *= 0x85ebca6b;
+  id ^= id >> 13;
+  id *= 0xc2b2ae35;
+  id ^= id >> 16;
+  return id;
+}
+
+// current time in ms since epoch
+static int64_t cronos_now_ms(){
+  struct timeval tv;
+  gettimeofday(&tv, NULL);
+  return static_cast<int64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+// library-wide memory counters
+static std::atomic<size_t> cronos_mem_bytes{0};
+static std::atomic<size_t> cronos_mem_peak{0};
+static std::atomic<uint32_t> cronos_mem_allocs{0};
+static std::atomic<uint32_t> cronos_mem_frees{0};
+static std::atomic<uint32_t> cronos_mem_tasks{0};
+static std::atomic<size_t> cronos_mem_task_bytes{0};
+
+void* cronos_alloc(size_t size){
+  void* p = ::operator new(size);
+  size_t bytes = cronos_mem_bytes += size;
+  size_t peak = cronos_mem_peak.load();
+  while (bytes > peak && !cronos_mem_peak.compare_exchange_weak(peak, bytes));
+  ++cronos_mem_allocs;
+  return p;
+}
+
+void cronos_free(void* ptr, size_t size){
+  if (!ptr) return;
+  cronos_mem_bytes -= size;
+  ++cronos_mem_frees;
+  ::operator delete(ptr);
+}
+
+// FNV-1a checksum of the state blob entries
+static uint32_t cronos_checksum(const uint8_t* data, size_t len){
+  uint32_t h = 0x811c9dc5;
+  while (len--){
+    h ^= *data++;
+    h *= 0x01000193;
+  }
+  return h;
+}
+
+// monotonic time in us, to time task runs
+static int64_t cronos_mono_us(){
+#ifdef ESP_PLATFORM
+  return esp_timer_get_time();
+#else
+  return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// broken-down time in the same timezone cron expressions are evaluated in
+static void cronos_tm(time_t t, struct tm* tm){
+#ifdef CRON_USE_LOCAL_TIME
+  localtime_r(&t, tm);
+#else
+  gmtime_r(&t, tm);
+#endif
+}
+
+// start of the next day in the same timezone cron expressions are evaluated in
+static time_t cronos_midnight(time_t now){
+#ifdef CRON_USE_LOCAL_TIME
+  struct tm tm;
+  cronos_tm(now, &tm);
+  tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+  tm.tm_mday += 1;
+  tm.tm_isdst = -1;
+  return mktime(&tm);
+#else
+  return (now / 86400 + 1) * 86400;
+#endif
+}
+
+#ifdef CRONOS_RTOS
+// convert ms delay to RTOS ticks, rounding up to not wake up before the deadline
+static TickType_t cronos_ticks(int64_t ms){
+  TickType_t t = (ms * configTICK_RATE_HZ + 999) / 1000;
+  return t ? t : 1;
+}
+#endif
+
+void* CronoS_Task::operator new(size_t size){
+  ++cronos_mem_tasks;
+  cronos_mem_task_bytes += size;
+  return cronos_alloc(size);
+}
+
+void CronoS_Task::operator delete(void* ptr, size_t size){
+  if (!ptr) return;
+  --cronos_mem_tasks;
+  cronos_mem_task_bytes -= size;
+  cronos_free(ptr, size);
+}
+
 CronoS_Task::CronoS_Task(const char* expression){
   setExpr(expression);
 }
 
+void CronoS_Task::_schedule(int64_t now_ms){
+  // find fire second which, with offset applied, is later than now
+  int64_t base = now_ms - _offset_ms;
+  time_t now = static_cast<time_t>(base >= 0 ? base / 1000 : (base - 999) / 1000);
+  time_t t = _tz ? cron_next_tz(&rule, _tz.get(), now - _spread) : cron_next(&rule, now - _spread);
+  next_run = t == CRON_INVALID_INSTANT ? t : t + _spread;
+}
+
 void CronoS_Task::setExpr(const char* expr){
   const char* err;
   cron_parse_expr(expr, &rule, &err);
@@ -36,22 +255,12 @@ void CronoS_Task::setExpr(const char* expr){
 }
 
 
-cronos_tid CronoS::addCallback(const char* expression, CronoS_Callback_t cb, void* arg){
-  std::lock_guard<std::mutex> lock(_mtx);
-  _tasks.emplace_back(std::make_unique<CronoS_Callback>(expression, cb, arg));
-  cronos_tid id = ++_cnt;
-  _tasks.back()->_id = id;
-  std::time_t now;
-  std::time(&now);
-  _tasks.back()->next_run = cron_next(&_tasks.back()->rule, now);
-  if (_tmr && xTimerIsTimerActive(_tmr))
-    xTimerChangePeriod(_tmr, 1, portMAX_DELAY);
-
-  return id;
+int64_t CronoS_Backend::max_sleep_ms() const {
+  return DEFAULT_RESCHEDULING_TIME;
 }
 
-
-CronoS::~CronoS(){
+#ifdef CRONOS_RTOS
+CronoS_RTOS_Backend::~CronoS_RTOS_Backend(){
   if (_tmr){
     xTimerStop( _tmr, portMAX_DELAY );
     xTimerDelete( _tmr, portMAX_DELAY );
@@ -59,91 +268,867 @@ CronoS::~CronoS(){
   }
 }
 
+int64_t CronoS_RTOS_Backend::now_ms(){
+  return cronos_now_ms();
+}
 
-void CronoS::start(){
+void CronoS_RTOS_Backend::arm(int64_t ms){
   if (!_tmr){
     _tmr = xTimerCreate(tag,
-                    1,        // we start with a 1 tick timer, it will recalculate on next run
+                    cronos_ticks(ms),
                     pdTRUE,
                     static_cast<void*>(this),
-                    [](TimerHandle_t h) { static_cast<CronoS*>(pvTimerGetTimerID(h))->_evaluate(); }
+                    [](TimerHandle_t h) { static_cast<CronoS_RTOS_Backend*>(pvTimerGetTimerID(h))->fire(); }
                   );
   } else {
-    xTimerChangePeriod(_tmr, 1, portMAX_DELAY);
+    xTimerChangePeriod(_tmr, cronos_ticks(ms), portMAX_DELAY);
   }
-
   xTimerReset( _tmr, portMAX_DELAY );
 }
 
-void CronoS::stop(){
+void CronoS_RTOS_Backend::disarm(){
   if (_tmr)
     xTimerStop( _tmr, portMAX_DELAY );
 }
 
+CronoS_Worker_Backend::CronoS_Worker_Backend(int core, UBaseType_t priority, uint32_t stack){
+#ifdef ESP_PLATFORM
+  xTaskCreatePinnedToCore(_loop, tag, stack, this, priority, &_task, core < 0 ? tskNO_AFFINITY : core);
+#else
+  (void)core;
+  xTaskCreate(_loop, tag, stack, this, priority, &_task);
+#endif
+}
+
+CronoS_Worker_Backend::~CronoS_Worker_Backend(){
+  stop();
+}
+
+void CronoS_Worker_Backend::stop(){
+  {
+    std::lock_guard<std::mutex> lock(_lock);
+    if (!_task) return;
+    _quit.store(true);
+    xTaskNotifyGive(_task);
+  }
+  // loop quits between the evaluations and parks, it is deleted here so that arm() never notifies a deleted task
+  while (!_done.load())
+    vTaskDelay(1);
+  std::lock_guard<std::mutex> lock(_lock);
+  vTaskDelete(_task);
+  _task = nullptr;
+}
+
+int64_t CronoS_Worker_Backend::now_ms(){
+  return cronos_now_ms();
+}
+
+void CronoS_Worker_Backend::arm(int64_t ms){
+  _deadline.store(cronos_now_ms() + (ms > 0 ? ms : 0));
+  std::lock_guard<std::mutex> lock(_lock);
+  if (_task)
+    xTaskNotifyGive(_task);
+}
+
+void CronoS_Worker_Backend::disarm(){
+  _deadline.store(-1);
+}
+
+void CronoS_Worker_Backend::_loop(void* arg){
+  CronoS_Worker_Backend* self = static_cast<CronoS_Worker_Backend*>(arg);
+  while (!self->_quit.load()){
+    int64_t deadline = self->_deadline.load();
+    if (deadline < 0){
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+      continue;
+    }
+    // wait till the deadline or till timer is rearmed
+    int64_t wait = deadline - cronos_now_ms();
+    if (wait > 0){
+      ulTaskNotifyTake(pdTRUE, cronos_ticks(wait));
+      continue;
+    }
+    if (self->_deadline.compare_exchange_strong(deadline, -1))
+      self->fire();
+  }
+  // backend object could be gone right after the ack, wait to be deleted by stop()
+  self->_done.store(true);
+  for (;;)
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+}
+#endif  // CRONOS_RTOS
+
+#ifdef __linux__
+uint64_t CronoS_SimBackend::run(int64_t until_ms){
+  uint64_t n{0};
+  while (_deadline >= 0 && _deadline <= until_ms){
+    _now = std::max(_now, _deadline);
+    _deadline = -1;
+    fire();
+    ++n;
+  }
+  _now = std::max(_now, until_ms);
+  return n;
+}
+
+void CronoS_SimBackend::setTime(int64_t ms){
+  if (_deadline >= 0)
+    _deadline += ms - _now;
+  _now = ms;
+}
+
+CronoS_POSIX_Backend::CronoS_POSIX_Backend(){
+  _tfd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+}
+
+CronoS_POSIX_Backend::~CronoS_POSIX_Backend(){
+  stop();
+  if (_tfd >= 0) close(_tfd);
+  if (_epfd >= 0) close(_epfd);
+  if (_efd >= 0) close(_efd);
+}
+
+int64_t CronoS_POSIX_Backend::now_ms(){
+  return cronos_now_ms();
+}
+
+void CronoS_POSIX_Backend::arm(int64_t ms){
+  // absolute time on the realtime clock, so that the kernel cancels the timer if the clock is set
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  int64_t ns = static_cast<int64_t>(now.tv_nsec) + (ms > 0 ? ms : 0) * 1000000;
+  struct itimerspec its{};
+  its.it_value.tv_sec = now.tv_sec + ns / 1000000000;
+  its.it_value.tv_nsec = ns % 1000000000;
+  timerfd_settime(_tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL);
+}
+
+void CronoS_POSIX_Backend::disarm(){
+  struct itimerspec its{};
+  timerfd_settime(_tfd, 0, &its, NULL);
+}
+
+void CronoS_POSIX_Backend::dispatch(){
+  uint64_t expirations;
+  if (read(_tfd, &expirations, sizeof(expirations)) == sizeof(expirations))
+    fire();
+  else if (errno == ECANCELED)
+    stepped();
+}
+
+bool CronoS_POSIX_Backend::_open_loop(){
+  if (_tfd < 0) return false;
+  if (_epfd >= 0) return true;
+  _epfd = epoll_create1(EPOLL_CLOEXEC);
+  _efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (_epfd < 0 || _efd < 0) return false;
+  struct epoll_event ev{};
+  ev.events = EPOLLIN;
+  ev.data.fd = _tfd;
+  epoll_ctl(_epfd, EPOLL_CTL_ADD, _tfd, &ev);
+  ev.data.fd = _efd;
+  epoll_ctl(_epfd, EPOLL_CTL_ADD, _efd, &ev);
+  return true;
+}
+
+int CronoS_POSIX_Backend::run(){
+  if (!_open_loop()) return -1;
+  while (!_stop){
+    struct epoll_event ev[2];
+    int n = epoll_wait(_epfd, ev, 2, -1);
+    if (n < 0 && errno != EINTR)
+      return -1;
+    for (int i = 0; i < n; ++i){
+      if (ev[i].data.fd == _tfd)
+        dispatch();
+      else {
+        uint64_t v;
+        ssize_t r = read(_efd, &v, sizeof(v));
+        (void)r;
+      }
+    }
+  }
+  return 0;
+}
+
+void CronoS_POSIX_Backend::spawn(int core){
+  if (_thread.joinable()) return;
+  _stop = false;
+  if (!_open_loop()) return;
+  _thread = std::thread([this](){ run(); });
+  if (core >= 0){
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(core, &set);
+    pthread_setaffinity_np(_thread.native_handle(), sizeof(set), &set);
+  }
+}
+
+void CronoS_POSIX_Backend::stop(){
+  _stop = true;
+  if (_efd >= 0){
+    uint64_t v{1};
+    ssize_t r = write(_efd, &v, sizeof(v));
+    (void)r;
+  }
+  // a loop can't join itself, it just exits
+  if (_thread.joinable() && _thread.get_id() != std::this_thread::get_id())
+    _thread.join();
+}
+
+void CronoS_FD::cronos_run(){
+  uint64_t v{1};
+  // a firing is dropped if descriptor would block
+  ssize_t r = write(_fd, &v, sizeof(v));
+  (void)r;
+}
+#endif
+
+cronos_tid CronoS::addCallback(const char* expression, CronoS_Callback_t cb, void* arg, uint32_t slack, const char* tz){
+  cron_tz rule;
+  if (tz){
+    // expression can't be evaluated in unknown zone
+    const char* err{nullptr};
+    cron_parse_tz(tz, &rule, &err);
+    if (err) return 0;
+  }
+  auto t = std::make_unique<CronoS_Callback>(expression, cb, arg);
+  t->_slack = slack;
+  // zone is shared with other tasks by addTask()
+  if (tz)
+    t->_tz = std::allocate_shared<cron_tz>(CronoS_Allocator<cron_tz>(), rule);
+  return addTask(std::move(t));
+}
+
+cronos_tid CronoS::addTask(CronoS_Task_pt task){
+  if (!task) return 0;
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = task.get();
+  _tasks.emplace_back(std::move(task));
+  t->_it = std::prev(_tasks.end());
+  // task moved from another shard keeps it's id
+  if (!t->_id)
+    t->_id = _next_id();
+  if (t->_tz)
+    t->_tz = _zone(*t->_tz);
+  if (t->_disabled){
+    t->_disabled = false;
+    _disable(t);
+  } else if (t->valid)
+    t->_schedule(_backend->now_ms());
+  _changed();
+  _wakeup();
+
+  return t->_id;
+}
+
+CronoS_Task_pt CronoS::_detach(cronos_tid id){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t) return nullptr;
+  CronoS_Task_pt task = std::move(*t->_it);
+  _erase(t);
+  t->_reload = false;
+  t->_planned = false;
+  _changed();
+  return task;
+}
+
+
+CronoS::CronoS(CronoS_Backend* backend) {
+  if (!backend){
+#ifdef CRONOS_RTOS
+    _default = std::make_unique<CronoS_RTOS_Backend>();
+#else
+    _default = std::make_unique<CronoS_POSIX_Backend>();
+#endif
+    backend = _default.get();
+  }
+  _backend = backend;
+  // backends that are notified of clock steps reload the rules right away
+  _backend->attach([this](){ _evaluate(); }, [this](){ CRONOS_TRACE_EVENT(time_jump, 0, 0); if (_running) reload(); });
+#ifndef CRONOS_RTOS
+  if (_default)
+    _default->spawn();
+#endif
+}
+
+CronoS::~CronoS(){
+#ifdef CRONOS_COROUTINES
+  {
+    // detach pending awaiters, those coroutines won't be resumed anymore
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (auto a = _awaiters; a; a = a->_link){
+      a->_cron = nullptr;
+      a->_pending = false;
+    }
+    _awaiters = nullptr;
+  }
+#endif
+  _backend->disarm();
+  // backend could outlive the scheduler, evaluation in progress is finished before it is unbound
+  _backend->attach(nullptr);
+#ifndef CRONOS_RTOS
+  // default backend's loop must be done before the tasks are destroyed
+  if (_default)
+    _default->stop();
+#endif
+}
+
+
+void CronoS::start(){
+  // we start asap, timer will recalculate on next run
+  _backend->arm(0);
+  _running = true;
+}
+
+void CronoS::stop(){
+  _running = false;
+  _backend->disarm();
+}
+
+void CronoS::_wakeup(){
+  // timer might be stopped when scheduler was idle
+  if (_running)
+    _backend->arm(0);
+}
+
 void CronoS::clear(){
   std::lock_guard<std::mutex> lock(_mtx);
   stop();
+  _pending.clear();
   _tasks.clear();
+  _disabled.clear();
+  _groups.clear();
+  _reloading = false;
+  _changed();
 };
 
-void CronoS::_evaluate(){
-  if (!_tasks.size()){
-    // disable timer when no tasks are present
-    stop();
+bool CronoS::_due(const CronoS_Task* t, int64_t now_ms){
+  // on-time tasks and tasks that are late for no more then CRONOS_TASK_MAX_LATE_TIME sec past it's slack window
+  int64_t late = now_ms - t->_due_ms();
+  return late >= 0 && late <= (CRONOS_TASK_MAX_LATE_TIME + static_cast<int64_t>(t->_slack)) * 1000;
+}
+
+bool CronoS::_before(const CronoS_Task* a, const CronoS_Task* b){
+  // demoted tasks go last
+  if (a->_demoted != b->_demoted)
+    return a->_demoted < b->_demoted;
+  if (a->_priority != b->_priority)
+    return a->_priority > b->_priority;
+  // earliest deadline first, by default a deadline is the end of task's late window
+  int64_t da = a->_ready_ms + (a->_budget_ms ? a->_budget_ms : (CRONOS_TASK_MAX_LATE_TIME + static_cast<int64_t>(a->_slack)) * 1000);
+  int64_t db = b->_ready_ms + (b->_budget_ms ? b->_budget_ms : (CRONOS_TASK_MAX_LATE_TIME + static_cast<int64_t>(b->_slack)) * 1000);
+  return da < db;
+}
+
+bool CronoS::_admit(CronoS_Task* t){
+  if (!t->_max_inflight)
+    return true;
+  if (t->_inflight < t->_max_inflight){
+    ++t->_inflight;
+    return true;
+  }
+  if (t->_overlap == CronoS_Overlap::queue && !t->_queued){
+    t->_queued = true;
+    ++_stats.queued;
+  } else
+    ++_stats.skipped;
+  return false;
+}
+
+void CronoS::_run(CronoS_Task* t){
+  CRONOS_TRACE_EVENT(run_start, t->_id, 0);
+  int64_t started = cronos_mono_us();
+  _run_started_us.store(static_cast<uint32_t>(started));
+  _run_id.store(t->_id);
+  t->cronos_run();
+  _run_id.store(0);
+  uint32_t spent = static_cast<uint32_t>(cronos_mono_us() - started);
+  CRONOS_TRACE_EVENT(run_end, t->_id, spent);
+  ++_stats.runs;
+  ++t->_runs;
+  _cpu_used_us += spent;
+
+  if (!t->_run_budget_us || spent <= t->_run_budget_us)
+    return;
+  ++_stats.overruns;
+#ifdef ESP_PLATFORM
+  ESP_LOGW(tag, "task %u overrun: %u us, budget %u us", static_cast<unsigned>(t->_id), static_cast<unsigned>(spent), static_cast<unsigned>(t->_run_budget_us));
+#endif
+  if (_onoverrun)
+    _onoverrun(t->_id, spent);
+  if (!t->_max_overruns || ++t->_overruns < t->_max_overruns)
     return;
+  // repeat offender is demoted first, then disabled
+  t->_overruns = 0;
+  if (++t->_demoted > 1)
+    _disable(t);
+  _changed();
+}
+
+int64_t CronoS::_throttle(int64_t now_ms){
+  if (!_cpu_quota_us)
+    return 0;
+  // new window each second, or if the clock has been stepped back
+  if (now_ms - _cpu_window_ms >= 1000 || now_ms < _cpu_window_ms){
+    _cpu_window_ms = now_ms;
+    _cpu_used_us = 0;
   }
+  if (_cpu_used_us < _cpu_quota_us)
+    return 0;
+  return _cpu_window_ms + 1000 - now_ms;
+}
 
-  std::time_t now;    // by default reevaluate tasks at least once in a minute
-  std::time(&now);
+bool CronoS::_idle() const {
+#ifdef CRONOS_COROUTINES
+  return !_tasks.size() && !_awaiters;
+#else
+  return !_tasks.size();
+#endif
+}
 
+void CronoS::_changed(){
+  _plan_dirty = true;
+  _publish();
+}
+
+void CronoS::_publish(){
+  auto snap = std::allocate_shared<CronoS_Snapshot>(CronoS_Allocator<CronoS_Snapshot>());
+  snap->reserve(_tasks.size() + _disabled.size());
+  int64_t deadline{-1};
+  for (auto l : {&_tasks, &_disabled}){
+    for (auto &t : *l){
+      snap->push_back({t->_id, t->rule, t->_spread, t->_slack, t->_offset_ms, t->_priority, t->_budget_ms, t->_overlap, t->_max_inflight, t->_tz,
+                        t->_run_budget_us, t->_max_overruns, t->_demoted, t->_group, !t->_disabled, t->valid});
+      if (t->_disabled)
+        continue;
+      // pending firing is due right away
+      int64_t d = t->_ready_ms >= 0 ? t->_ready_ms : (t->valid && t->next_run != CRON_INVALID_INSTANT ? t->_due_ms() : -1);
+      if (d >= 0 && (deadline < 0 || d < deadline))
+        deadline = d;
+    }
+  }
+  _deadline_ms.store(deadline);
+#ifdef __cpp_lib_atomic_shared_ptr
+  _snapshot.store(std::move(snap));
+#else
+  std::atomic_store(&_snapshot, CronoS_Snapshot_pt(std::move(snap)));
+#endif
+}
+
+CronoS_Snapshot_pt CronoS::getSnapshot() const {
+#ifdef __cpp_lib_atomic_shared_ptr
+  return _snapshot.load();
+#else
+  return std::atomic_load(&_snapshot);
+#endif
+}
+
+time_t CronoS::getNextRun(cronos_tid id){
   std::lock_guard<std::mutex> lock(_mtx);
-  for (auto i = _tasks.begin(); i != _tasks.end(); ++i){
-    // skip malformed/disabled tasks
-    if (!(*i)->valid){
-      continue;
+  CronoS_Task* t = _find(id);
+  return t && t->valid ? t->next_run : CRON_INVALID_INSTANT;
+}
+
+uint32_t CronoS::getRuns(cronos_tid id){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  return t ? t->_runs : 0;
+}
+
+CronoS_Task* CronoS::_find(cronos_tid id){
+  for (auto &t : _tasks ){
+    if (t->getID() == id)
+      return t.get();
+  }
+  for (auto &t : _disabled ){
+    if (t->getID() == id)
+      return t.get();
+  }
+  return nullptr;
+}
+
+void CronoS::_group_link(CronoS_Task* t, cronos_gid group){
+  t->_group = group;
+  if (!group) return;
+  CronoS_Task* &head = _groups[group];
+  t->_gprev = nullptr;
+  t->_gnext = head;
+  if (head)
+    head->_gprev = t;
+  head = t;
+}
+
+void CronoS::_group_unlink(CronoS_Task* t){
+  if (!t->_group) return;
+  if (t->_gprev)
+    t->_gprev->_gnext = t->_gnext;
+  else if (t->_gnext)
+    _groups[t->_group] = t->_gnext;
+  else
+    _groups.erase(t->_group);
+  if (t->_gnext)
+    t->_gnext->_gprev = t->_gprev;
+  t->_gprev = t->_gnext = nullptr;
+  t->_group = 0;
+}
+
+void CronoS::_erase(CronoS_Task* t){
+  _group_unlink(t);
+  // next evaluation walks all the tasks
+  _pending.clear();
+  if (t->_disabled){
+    _disabled.erase(t->_it);
+    return;
+  }
+  if (_reloading && t->_it == _reload_it)
+    ++_reload_it;
+  _tasks.erase(t->_it);
+}
+
+void CronoS::_disable(CronoS_Task* t){
+  if (t->_disabled) return;
+  if (_reloading && t->_it == _reload_it)
+    ++_reload_it;
+  t->_disabled = true;
+  t->_ready_ms = -1;
+  t->_queued = false;
+  t->_reload = false;
+  _disabled.splice(_disabled.end(), _tasks, t->_it);
+}
+
+void CronoS::_enable(CronoS_Task* t, int64_t now_ms){
+  if (!t->_disabled) return;
+  t->_disabled = false;
+  _tasks.splice(_tasks.end(), _disabled, t->_it);
+  if (t->valid)
+    t->_schedule(now_ms);
+}
+
+void CronoS::_evaluate(){
+  ++_stats.evaluations;
+  // evaluation right after a run, time has not moved much since the previous one
+  bool yielded = _yield;
+  if (_yield)
+    _yield = false;
+  else
+    ++_stats.wakeups;
+
+  int64_t now_ms = _backend->now_ms();
+  // reevaluate tasks at least once in backend's max sleep time, DEFAULT_RESCHEDULING_TIME for the RTOS timer
+  int64_t wakeup = now_ms + _backend->max_sleep_ms();
+  CRONOS_TRACE_EVENT(wakeup, 0, yielded);
+#ifdef CRONOS_TRACE
+  if (_backend->realtime()){
+    // clock has moved apart from the monotonic time for more than a second since the previous evaluation
+    int64_t mono = cronos_mono_us();
+    int64_t step = (now_ms - _trace_now_ms) - (mono - _trace_mono_us) / 1000;
+    if (_trace_mono_us && (step > 1000 || step < -1000))
+      CRONOS_TRACE_EVENT(time_jump, 0, static_cast<int32_t>(std::clamp<int64_t>(step, INT32_MIN, INT32_MAX)));
+    _trace_now_ms = now_ms;
+    _trace_mono_us = mono;
+  }
+#endif
+
+#ifdef CRONOS_COROUTINES
+  wakeup = std::min(wakeup, _resume(now_ms));
+#endif
+
+  std::lock_guard<std::mutex> lock(_mtx);
+  if (_idle()){
+    // disable timer when no tasks are present, it will be restarted on new tasks.
+    // Checked under the lock, so a task added meanwhile arms the timer after this disarm
+    _backend->disarm();
+    return;
+  }
+
+  if (_reloading)
+    _reload_chunk(now_ms);
+
+  // plan is not used until reload is finished
+  bool planned = _plan_max && !_reloading;
+  if (planned){
+    if (_plan_dirty || now_ms >= _plan_end_ms || now_ms < _plan_seen_ms)
+      _plan_build(now_ms);
+    _plan_seen_ms = now_ms;
+
+    // planned tasks that are due are marked pending, those are dispatched along with the live ones
+    while (_plan_pos != _plan.size()){
+      const plan_entry_t &e = _plan[_plan_pos];
+      // task still holds a pending run of an earlier slot, its later slot waits for it to be dispatched
+      if (_plan_due(e) > now_ms || e.task->_ready_ms >= 0)
+        break;
+      ++_plan_pos;
+      CronoS_Task* t = e.task;
+      bool due = _due(t, now_ms);
+      if (due){
+        t->_ready_ms = t->_due_ms();
+        _pending.push_back(t);
+        CRONOS_TRACE_EVENT(due, t->_id, static_cast<int32_t>(now_ms - t->_ready_ms));
+      }
+      // step to the task's next fire time, past the plan it is calculated live
+      if (e.next != UINT32_MAX)
+        t->next_run = static_cast<time_t>((_plan_due(_plan[e.next]) - t->_offset_ms) / 1000);
+      else
+        t->_schedule(due ? t->_ready_ms : now_ms);
+      CRONOS_TRACE_EVENT(next_run, t->_id, static_cast<int32_t>(t->next_run));
     }
 
-    // execute on-time tasks and tasks that are late for no more then CRONOS_TASK_MAX_LATE_TIME sec
-    if (now == (*i)->next_run || (now > (*i)->next_run && now - (*i)->next_run <= CRONOS_TASK_MAX_LATE_TIME) ){
-      (*i)->cronos_run();
-      (*i)->next_run = cron_next(&(*i)->rule, now);
-      // since some task has just runned, let's give a chance to a scheduler to go with another threads before we continue with next one
-      // this is to not create a congestion when multiple tasks should run at the same time
-      xTimerChangePeriod(_tmr, 1, portMAX_DELAY);
-      xTimerReset( _tmr, portMAX_DELAY );
-      return;
-    } else {
-      // recalculate next time
-      // it is an overkill to do this each time, but it's the only proof way to handle any sporadic large time adjustments back and forth
-      (*i)->next_run = cron_next(&(*i)->rule, now);
-      //Serial.printf("Next event in %u sec\n", (*i)->next_run - now);
-      //ESP_LOGV(tag,"Next event in %u sec\n", (*i)->next_run - now);
+    // earliest end of the tolerance window among the planned tasks
+    for (size_t i = _plan_pos; i != _plan.size() && _plan_due(_plan[i]) < wakeup; ++i)
+      wakeup = std::min(wakeup, _plan_due(_plan[i]) + static_cast<int64_t>(_plan[i].task->_slack) * 1000);
+    // rebuild at midnight
+    wakeup = std::min(wakeup, _plan_end_ms);
+  }
+
+  // pending task to dispatch next
+  CronoS_Task* next{nullptr};
+  // earliest dispatch time, see nextDeadline(), pending firing is due right away
+  int64_t deadline{-1};
+  auto earliest = [&deadline](int64_t d){ if (deadline < 0 || d < deadline) deadline = d; };
+
+  // evaluation right after a run picks from the tasks found pending before, nothing else has been rescheduled since then,
+  // tasks that are not pending are accounted by the full evaluation that follows the last pending run
+  if (yielded && !_reloading){
+    size_t n = 0;
+    for (CronoS_Task* t : _pending){
+      if (t->_ready_ms < 0)
+        continue;
+      _pending[n++] = t;
+      earliest(t->_ready_ms);
+      if (!next || _before(t, next))
+        next = t;
     }
+    _pending.resize(n);
+    // throttled run needs the wakeups of all the tasks
+    if (next && _throttle(now_ms))
+      next = nullptr;
+  }
+
+  if (!next){
+    deadline = -1;
+    _pending.clear();
+    for (auto i = _tasks.begin(); i != _tasks.end(); ++i){
+      CronoS_Task* t = i->get();
+      if (t->_ready_ms >= 0){
+        _pending.push_back(t);
+        earliest(t->_ready_ms);
+        if (!next || _before(t, next))
+          next = t;
+        continue;
+      }
+
+      // skip malformed/disabled tasks, tasks pending reload and planned tasks
+      if (!t->valid || t->_reload || (planned && t->_planned)){
+        if (t->valid && t->next_run != CRON_INVALID_INSTANT)
+          earliest(t->_due_ms());
+        continue;
+      }
+
+      // on-time tasks and tasks that are late for no more then CRONOS_TASK_MAX_LATE_TIME sec are marked pending
+      if (_due(t, now_ms)){
+        t->_ready_ms = t->_due_ms();
+        _pending.push_back(t);
+        CRONOS_TRACE_EVENT(due, t->_id, static_cast<int32_t>(now_ms - t->_ready_ms));
+        // step from the slot that fired, not from now, a wakeup delayed by the slack window may already be past the next slot,
+        // that one is then due on the following evaluation
+        earliest(t->_ready_ms);
+        t->_schedule(t->_ready_ms);
+        CRONOS_TRACE_EVENT(next_run, t->_id, static_cast<int32_t>(t->next_run));
+        if (!next || _before(t, next))
+          next = t;
+      } else {
+        // recalculate next time
+        // it is an overkill to do this each time, but it's the only proof way to handle any sporadic large time adjustments back and forth
+        if (!yielded){
+#ifdef CRONOS_TRACE
+          time_t prev = t->next_run;
+          t->_schedule(now_ms);
+          if (t->next_run != prev)
+            CRONOS_TRACE_EVENT(next_run, t->_id, static_cast<int32_t>(t->next_run));
+#else
+          t->_schedule(now_ms);
+#endif
+        }
+        // wake up at the end of the earliest tolerance window, all tasks that are due by that time will run on the same wakeup
+        if (t->next_run != CRON_INVALID_INSTANT){
+          earliest(t->_due_ms());
+          wakeup = std::min(wakeup, t->_due_ms() + static_cast<int64_t>(t->_slack) * 1000);
+        }
+        //ESP_LOGV(tag,"Next event in %u sec\n", t->next_run - now);
+      }
 
+    }
   }
+  _deadline_ms.store(deadline);
 
-  //ESP_LOGI(tag, "Sleep for: %u\n", awake);
-  //Serial.printf("Sleep for: %u\n", earliest);
+  // callback time quota is exhausted, due tasks are held pending till the next quota window
+  if (next){
+    if (int64_t wait = _throttle(now_ms)){
+      ++_stats.throttled;
+      wakeup = std::min(wakeup, now_ms + wait);
+      next = nullptr;
+    }
+  }
 
-  xTimerChangePeriod(_tmr, pdMS_TO_TICKS(DEFAULT_RESCHEDULING_TIME), portMAX_DELAY);
-  xTimerReset( _tmr, portMAX_DELAY );
+  if (next){
+    next->_ready_ms = -1;
+    if (_admit(next))
+      _run(next);
+    // since some task has just runned, let's give a chance to a scheduler to go with another threads before we continue with next one
+    // this is to not create a congestion when multiple tasks should run at the same time
+    _yield = true;
+    CRONOS_TRACE_EVENT(arm, 0, 0);
+    _backend->arm(0);
+    return;
+  }
+
+  // yield before the next reload chunk
+  if (_reloading){
+    _yield = true;
+    wakeup = now_ms;
+  }
+
+  //ESP_LOGI(tag, "Sleep for: %u\n", wakeup - now_ms);
+
+  // sleep until the earliest task is due
+  CRONOS_TRACE_EVENT(arm, 0, static_cast<int32_t>(wakeup - now_ms));
+  _backend->arm(wakeup - now_ms);
+}
+
+#ifdef CRONOS_TRACE
+void CronoS::_trace(CronoS_TraceEvent event, cronos_tid id, int32_t value){
+  // writers only contend for the slot index
+  CronoS_TraceEntry &e = _trace_buf[_trace_head.fetch_add(1, std::memory_order_relaxed) & (CRONOS_TRACE_SIZE - 1)];
+  e.ts_us = static_cast<uint32_t>(cronos_mono_us());
+  e.id = id;
+  e.value = value;
+  e.event = event;
+}
+#endif
+
+void CronoS::_seen_id(cronos_tid id){
+  if (!_ids){
+    _cnt = std::max(_cnt, id);
+    return;
+  }
+  cronos_tid cnt = _ids->load();
+  while (cnt < id && !_ids->compare_exchange_weak(cnt, id));
+}
+
+CronoS_Stats CronoS::getStats() const {
+  return { _stats.wakeups, _stats.evaluations, _stats.runs, _stats.skipped, _stats.queued, _stats.overruns, _stats.throttled };
+}
+
+void CronoS::resetStats(){
+  _stats.wakeups = _stats.evaluations = _stats.runs = _stats.skipped = _stats.queued = _stats.overruns = _stats.throttled = 0;
+}
+
+CronoS_PlanStats CronoS::getPlanStats() const {
+  std::lock_guard<std::mutex> lock(_mtx);
+  return _plan_stats;
+}
+
+size_t CronoS::dumpTrace(uint8_t* buffer, size_t len) const {
+#ifdef CRONOS_TRACE
+  uint32_t head = _trace_head.load();
+  uint32_t count = std::min<uint32_t>(head, CRONOS_TRACE_SIZE);
+#else
+  uint32_t count{0};
+#endif
+  size_t size = sizeof(cronos_trace_header_t) + count * sizeof(CronoS_TraceEntry);
+  if (!buffer) return size;
+  if (len < size) return 0;
+
+  cronos_trace_header_t h{CRONOS_TRACE_MAGIC, CRONOS_TRACE_VERSION, sizeof(CronoS_TraceEntry), count};
+  std::memcpy(buffer, &h, sizeof(h));
+  buffer += sizeof(h);
+#ifdef CRONOS_TRACE
+  // oldest entry first, entries that are recorded while dumping may overwrite the oldest ones
+  for (uint32_t i = head - count; i != head; ++i, buffer += sizeof(CronoS_TraceEntry))
+    std::memcpy(buffer, &_trace_buf[i & (CRONOS_TRACE_SIZE - 1)], sizeof(CronoS_TraceEntry));
+#endif
+  return size;
 }
 
 void CronoS::removeTask(cronos_tid id){
   std::lock_guard<std::mutex> lock(_mtx);
-  for (auto i = _tasks.begin(); i != _tasks.end(); ++i){
-    if (i->get()->_id == id){
-      _tasks.erase(i);
-      return;
-    }
+  CronoS_Task* t = _find(id);
+  if (!t) return;
+  _erase(t);
+  _changed();
+}
+
+void CronoS::setGroup(cronos_tid id, cronos_gid group){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t || t->_group == group) return;
+  _group_unlink(t);
+  _group_link(t, group);
+  _changed();
+}
+
+void CronoS::disableGroup(cronos_gid group){
+  std::lock_guard<std::mutex> lock(_mtx);
+  auto g = _groups.find(group);
+  if (g == _groups.end()) return;
+  for (CronoS_Task* t = g->second; t; t = t->_gnext)
+    _disable(t);
+  _changed();
+}
+
+void CronoS::enableGroup(cronos_gid group){
+  std::lock_guard<std::mutex> lock(_mtx);
+  auto g = _groups.find(group);
+  if (g == _groups.end()) return;
+  int64_t now_ms = _backend->now_ms();
+  for (CronoS_Task* t = g->second; t; t = t->_gnext)
+    _enable(t, now_ms);
+  _changed();
+  _wakeup();
+}
+
+void CronoS::removeGroup(cronos_gid group){
+  std::lock_guard<std::mutex> lock(_mtx);
+  auto g = _groups.find(group);
+  if (g == _groups.end()) return;
+  for (CronoS_Task* t = g->second; t; ){
+    CronoS_Task* next = t->_gnext;
+    // group's list is dropped as a whole
+    t->_group = 0;
+    _erase(t);
+    t = next;
+  }
+  _groups.erase(g);
+  _changed();
+}
+
+void CronoS::setGroupExpr(cronos_gid group, const char* expr){
+  cron_expr rule;
+  const char* err{nullptr};
+  cron_parse_expr(expr, &rule, &err);
+  std::lock_guard<std::mutex> lock(_mtx);
+  auto g = _groups.find(group);
+  if (g == _groups.end()) return;
+  int64_t now_ms = _backend->now_ms();
+  for (CronoS_Task* t = g->second; t; t = t->_gnext){
+    t->rule = rule;
+    t->valid = (err == NULL);
+    // pending firing of the old rule is dropped
+    t->_ready_ms = -1;
+    if (t->valid && !t->_disabled)
+      t->_schedule(now_ms);
   }
+  _changed();
 }
 
 int CronoS::getCrontab(cronos_tid id, char *buffer, int buffer_len, int expr_len, const char **error) const {
-  //std::lock_guard<std::mutex> lock(_mtx);
-  for (auto i = _tasks.begin(); i != _tasks.end(); ++i){
-    if (i->get()->_id == id){
-      return cron_generate_expr(&((*i)->rule), buffer, buffer_len, expr_len, error);
+  auto snap = getSnapshot();
+  for (auto &t : *snap){
+    if (t.id == id){
+      cron_expr rule = t.rule;
+      return cron_generate_expr(&rule, buffer, buffer_len, expr_len, error);
     }
   }
 
@@ -152,26 +1137,798 @@ int CronoS::getCrontab(cronos_tid id, char *buffer, int buffer_len, int expr_len
 
 void CronoS::setExpr(cronos_tid id, const char *expr){
   std::lock_guard<std::mutex> lock(_mtx);
-  for (auto &t : _tasks ){
-    if (t->getID() == id){
-      t->setExpr(expr);
-      if (t->valid){
-        std::time_t now;
-        std::time(&now);
-        t->next_run = cron_next(&(t->rule), now);
+  CronoS_Task* t = _find(id);
+  if (!t) return;
+  t->setExpr(expr);
+  // pending firing of the old rule is dropped
+  t->_ready_ms = -1;
+  if (t->valid)
+    t->_schedule(_backend->now_ms());
+  _changed();
+}
+
+void CronoS::setSpread(cronos_tid id, uint32_t window){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t) return;
+  t->_spread = window ? cronos_hash(id) % window : 0;
+  if (t->valid)
+    t->_schedule(_backend->now_ms());
+  _changed();
+}
+
+void CronoS::setOffset(cronos_tid id, uint16_t ms){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t) return;
+  t->_offset_ms = ms < 1000 ? ms : 999;
+  if (t->valid)
+    t->_schedule(_backend->now_ms());
+  _changed();
+}
+
+void CronoS::setSlack(cronos_tid id, uint32_t slack){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t) return;
+  t->_slack = slack;
+  _changed();
+}
+
+void CronoS::setPriority(cronos_tid id, uint8_t priority, uint32_t budget_ms){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t) return;
+  t->_priority = priority;
+  t->_budget_ms = budget_ms;
+  _changed();
+}
+
+void CronoS::setOverlap(cronos_tid id, CronoS_Overlap policy, uint8_t instances){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t) return;
+  t->_overlap = policy;
+  // skip and queue policies always track runs
+  t->_max_inflight = policy == CronoS_Overlap::allow || instances ? instances : 1;
+  if (!t->_max_inflight)
+    t->_inflight = 0;
+  if (policy != CronoS_Overlap::queue)
+    t->_queued = false;
+  _changed();
+}
+
+void CronoS::setRunBudget(cronos_tid id, uint32_t budget_us, uint8_t max_overruns){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t) return;
+  t->_run_budget_us = budget_us;
+  t->_max_overruns = max_overruns;
+  t->_overruns = 0;
+  // task disabled by the watchdog is enabled back
+  if (t->_demoted > 1)
+    _enable(t, _backend->now_ms());
+  t->_demoted = 0;
+  _changed();
+}
+
+void CronoS::setCpuQuota(uint32_t us_per_second){
+  std::lock_guard<std::mutex> lock(_mtx);
+  _cpu_quota_us = us_per_second;
+}
+
+void CronoS::onOverrun(CronoS_Overrun_t f){
+  std::lock_guard<std::mutex> lock(_mtx);
+  _onoverrun = f;
+}
+
+cronos_tid CronoS::busy(uint32_t* elapsed_us) const {
+  cronos_tid id = _run_id.load();
+  uint32_t started = _run_started_us.load();
+  if (elapsed_us)
+    *elapsed_us = id ? static_cast<uint32_t>(cronos_mono_us()) - started : 0;
+  return id;
+}
+
+std::shared_ptr<const cron_tz> CronoS::_zone(const cron_tz& tz){
+  std::shared_ptr<const cron_tz> found;
+  for (auto i = _zones.begin(); i != _zones.end(); ){
+    if (!found && !std::memcmp(i->get(), &tz, sizeof(tz)))
+      found = *i;
+    // drop zones that are not used by any task
+    if (i->use_count() == 1 && *i != found)
+      i = _zones.erase(i);
+    else
+      ++i;
+  }
+  if (!found){
+    found = std::allocate_shared<cron_tz>(CronoS_Allocator<cron_tz>(), tz);
+    _zones.push_back(found);
+  }
+  return found;
+}
+
+bool CronoS::setTZ(cronos_tid id, const char* tz){
+  cron_tz rule;
+  const char* err{nullptr};
+  if (tz){
+    cron_parse_tz(tz, &rule, &err);
+    if (err) return false;
+  }
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t) return false;
+  if (tz)
+    t->_tz = _zone(rule);
+  else
+    t->_tz.reset();
+  if (t->valid)
+    t->_schedule(_backend->now_ms());
+  _changed();
+  return true;
+}
+
+void CronoS::done(cronos_tid id){
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS_Task* t = _find(id);
+  if (!t || !t->_inflight) return;
+  --t->_inflight;
+  if (t->_queued){
+    // dispatch queued run asap, with the priority of a firing that is due right now
+    t->_queued = false;
+    if (t->_ready_ms < 0){
+      t->_ready_ms = _backend->now_ms();
+      _pending.push_back(t);
+    }
+    _wakeup();
+  }
+}
+
+size_t CronoS::saveImage(uint8_t* buffer, size_t len){
+  std::lock_guard<std::mutex> lock(_mtx);
+  size_t count = _tasks.size() + _disabled.size();
+  size_t size = sizeof(cronos_image_header_t) + count * sizeof(cronos_image_entry_t);
+  if (!buffer) return size;
+  if (len < size) return 0;
+
+  uint8_t* entries = buffer + sizeof(cronos_image_header_t);
+  buffer = entries;
+  for (auto l : {&_tasks, &_disabled}){
+    for (auto &t : *l){
+      cronos_image_entry_t e{};
+      e.next_run = t->next_run;
+      e.id = t->_id;
+      e.spread = t->_spread;
+      e.slack = t->_slack;
+      e.offset_ms = t->_offset_ms;
+      e.valid = t->valid;
+      e.priority = t->_priority;
+      e.budget_ms = t->_budget_ms;
+      e.overlap = static_cast<uint8_t>(t->_overlap);
+      e.max_inflight = t->_max_inflight;
+      e.has_tz = t->_tz != nullptr;
+      e.max_overruns = t->_max_overruns;
+      e.overruns = t->_overruns;
+      e.demoted = t->_demoted;
+      e.run_budget_us = t->_run_budget_us;
+      e.runs = t->_runs;
+      e.group = t->_group;
+      e.disabled = t->_disabled;
+      if (t->_tz)
+        e.tz = *t->_tz;
+      e.rule = t->rule;
+      std::memcpy(buffer, &e, sizeof(e));
+      buffer += sizeof(e);
+    }
+  }
+  cronos_image_header_t h{CRONOS_IMAGE_MAGIC, CRONOS_IMAGE_VERSION, sizeof(cronos_image_entry_t), static_cast<uint32_t>(count), _ids ? _ids->load() : _cnt,
+                          sizeof(cron_expr), sizeof(cron_tz), cronos_checksum(entries, buffer - entries)};
+  std::memcpy(entries - sizeof(h), &h, sizeof(h));
+  return size;
+}
+
+int CronoS::loadImage(const uint8_t* buffer, size_t len, CronoS_Binder_t binder){
+  cronos_image_header_t h;
+  if (!buffer || !binder || len < sizeof(h)) return -1;
+  std::memcpy(&h, buffer, sizeof(h));
+  if (h.magic != CRONOS_IMAGE_MAGIC || h.version != CRONOS_IMAGE_VERSION || h.entry_size != sizeof(cronos_image_entry_t)
+      || h.expr_size != sizeof(cron_expr) || h.tz_size != sizeof(cron_tz) || h.count > (len - sizeof(h)) / sizeof(cronos_image_entry_t)
+      || h.sum != cronos_checksum(buffer + sizeof(h), h.count * sizeof(cronos_image_entry_t)))
+    return -1;
+  buffer += sizeof(h);
+
+  // an image with values no build writes is rejected as a whole
+  for (uint32_t i = 0; i != h.count; ++i){
+    cronos_image_entry_t e;
+    std::memcpy(&e, buffer + i * sizeof(e), sizeof(e));
+    if (e.overlap > static_cast<uint8_t>(CronoS_Overlap::queue) || e.offset_ms > 999 || e.valid > 1 || e.has_tz > 1
+        || e.disabled > 1 || e.demoted > 2)
+      return -1;
+  }
+
+  // tasks are bound out of the lock, binder could call into the scheduler
+  CronoS_TaskList tasks;
+  int64_t now_ms = _backend->now_ms();
+  for (uint32_t i = 0; i != h.count; ++i, buffer += sizeof(cronos_image_entry_t)){
+    cronos_image_entry_t e;
+    std::memcpy(&e, buffer, sizeof(e));
+    CronoS_Callback_t cb{nullptr};
+    void* arg{nullptr};
+    if (!binder(e.id, cb, arg))
+      continue;
+
+    tasks.emplace_back(std::make_unique<CronoS_Callback>(e.rule, cb, arg));
+    auto &t = tasks.back();
+    t->_id = e.id;
+    t->_spread = e.spread;
+    t->_slack = e.slack;
+    t->_offset_ms = e.offset_ms;
+    t->valid = e.valid;
+    t->_priority = e.priority;
+    t->_budget_ms = e.budget_ms;
+    t->_overlap = static_cast<CronoS_Overlap>(e.overlap);
+    t->_max_inflight = e.max_inflight;
+    t->_max_overruns = e.max_overruns;
+    t->_overruns = e.overruns;
+    t->_demoted = e.demoted;
+    t->_run_budget_us = e.run_budget_us;
+    t->_runs = e.runs;
+    if (e.has_tz)
+      t->_tz = std::allocate_shared<cron_tz>(CronoS_Allocator<cron_tz>(), e.tz);
+    t->next_run = static_cast<time_t>(e.next_run);
+    // fix-up next run times that are already in the past, tasks due right now are left to run
+    if (t->valid && t->_due_ms() < now_ms && !_due(t.get(), now_ms))
+      t->_schedule(now_ms);
+    // task is linked to it's group and disabled once it is in the table
+    t->_group = e.group;
+    t->_disabled = e.disabled;
+  }
+
+  std::lock_guard<std::mutex> lock(_mtx);
+  bool check_dups = _tasks.size() || _disabled.size();
+  int restored{0};
+  for (auto i = tasks.begin(); i != tasks.end(); ){
+    auto it = i++;
+    CronoS_Task* t = it->get();
+    if (check_dups && _find(t->_id))
+      continue;
+    _tasks.splice(_tasks.end(), tasks, it);
+    t->_it = it;
+    // share zones with the tasks already loaded
+    if (t->_tz)
+      t->_tz = _zone(*t->_tz);
+    cronos_gid group = t->_group;
+    _group_link(t, group);
+    if (t->_disabled){
+      t->_disabled = false;
+      _disable(t);
+    }
+    ++restored;
+  }
+  _seen_id(h.cnt);
+  if (restored)
+    _changed();
+  _wakeup();
+  return restored;
+}
+
+size_t CronoS::saveState(uint8_t* buffer, size_t len){
+  std::lock_guard<std::mutex> lock(_mtx);
+  size_t count = _tasks.size() + _disabled.size();
+  size_t size = sizeof(cronos_state_header_t) + count * sizeof(cronos_state_entry_t);
+  if (!buffer) return size;
+  if (len < size) return 0;
+
+  uint8_t* entries = buffer + sizeof(cronos_state_header_t);
+  uint8_t* p = entries;
+  for (auto l : {&_tasks, &_disabled}){
+    for (auto &t : *l){
+      // a pending firing is saved as the fire time, so it is run on wake
+      int64_t next = t->_ready_ms >= 0 ? t->_ready_ms / 1000 : t->next_run;
+      cronos_state_entry_t e{next, t->_id, t->_runs};
+      std::memcpy(p, &e, sizeof(e));
+      p += sizeof(e);
+    }
+  }
+  cronos_state_header_t h{CRONOS_STATE_MAGIC, static_cast<uint32_t>(count), cronos_checksum(entries, p - entries)};
+  std::memcpy(buffer, &h, sizeof(h));
+  return size;
+}
+
+int CronoS::loadState(const uint8_t* buffer, size_t len){
+  cronos_state_header_t h;
+  if (!buffer || len < sizeof(h)) return -1;
+  std::memcpy(&h, buffer, sizeof(h));
+  if (h.magic != CRONOS_STATE_MAGIC || h.count > (len - sizeof(h)) / sizeof(cronos_state_entry_t)
+      || h.sum != cronos_checksum(buffer + sizeof(h), h.count * sizeof(cronos_state_entry_t)))
+    return -1;
+  buffer += sizeof(h);
+
+  std::lock_guard<std::mutex> lock(_mtx);
+  int64_t now_ms = _backend->now_ms();
+  int restored{0};
+  for (uint32_t i = 0; i != h.count; ++i, buffer += sizeof(cronos_state_entry_t)){
+    cronos_state_entry_t e;
+    std::memcpy(&e, buffer, sizeof(e));
+    CronoS_Task* t = _find(e.id);
+    if (!t) continue;
+    t->_runs = e.runs;
+    if (t->valid && !t->_disabled && e.next_run != CRON_INVALID_INSTANT){
+      t->next_run = static_cast<time_t>(e.next_run);
+      // task has become due while sleeping, it is run once and stepped to the next fire time
+      if (t->_due_ms() <= now_ms){
+        t->_ready_ms = t->_due_ms();
+        _pending.push_back(t);
+        t->_schedule(now_ms);
       }
-      return;
     }
+    ++restored;
   }
+  if (restored)
+    _changed();
+  _wakeup();
+  return restored;
 }
 
-void CronoS::reload(){
+int CronoS::loadCrontab(const char* text, size_t len, CronoS_Resolver_t resolver, CronoS_LoadError_t onerror){
+  if (!text || !resolver) return 0;
+  CronoS_TaskList tasks;
+  int64_t now_ms = _backend->now_ms();
+  const char* end = text + len;
+  unsigned line{0};
+  // timezone set by CRON_TZ= line
+  std::shared_ptr<const cron_tz> tz;
+
+  for (const char* eol = text; text < end; text = eol + (eol < end)){
+    ++line;
+    eol = static_cast<const char*>(std::memchr(text, '\n', end - text));
+    if (!eol) eol = end;
+
+    // trim the line
+    const char* b = text;
+    const char* e = eol;
+    while (b != e && isspace(static_cast<unsigned char>(*b))) ++b;
+    while (e != b && isspace(static_cast<unsigned char>(e[-1]))) --e;
+    if (b == e || *b == '#') continue;
+
+    // timezone for the following lines
+    if (e - b >= 8 && !std::memcmp(b, "CRON_TZ=", 8)){
+      // TZ string has to be nul-terminated for the parser
+      char name[64];
+      size_t n = e - b - 8;
+      tz.reset();
+      if (n){
+        cron_tz rule;
+        const char* err{nullptr};
+        if (n < sizeof(name)){
+          std::memcpy(name, b + 8, n);
+          name[n] = 0;
+          cron_parse_tz(name, &rule, &err);
+        } else
+          err = "Invalid TZ name";
+        if (err){
+          if (onerror) onerror(line, err);
+        } else
+          tz = std::allocate_shared<cron_tz>(CronoS_Allocator<cron_tz>(), rule);
+      }
+      continue;
+    }
+
+    // job name is the last word of the line
+    const char* name = e;
+    while (name != b && !isspace(static_cast<unsigned char>(name[-1]))) --name;
+    if (name == b){
+      if (onerror) onerror(line, "Missing job name");
+      continue;
+    }
+
+    cron_expr rule;
+    const char* err{nullptr};
+    cron_parse_expr_n(b, name - b, &rule, &err);
+    if (err){
+      if (onerror) onerror(line, err);
+      continue;
+    }
+
+    CronoS_Callback_t cb{nullptr};
+    void* arg{nullptr};
+    if (!resolver(name, e - name, cb, arg)){
+      if (onerror) onerror(line, "Unknown job name");
+      continue;
+    }
+
+    tasks.emplace_back(std::make_unique<CronoS_Callback>(rule, cb, arg));
+    tasks.back()->_tz = tz;
+    tasks.back()->_schedule(now_ms);
+  }
+
+  int loaded = tasks.size();
+  if (!loaded) return 0;
   std::lock_guard<std::mutex> lock(_mtx);
-  std::time_t now;
-  std::time(&now);
-  for (auto i = _tasks.begin(); i != _tasks.end(); ++i){
-    if ( (*i)->valid )
-      (*i)->next_run = cron_next(&(*i)->rule, now);
+  for (auto i = tasks.begin(); i != tasks.end(); ++i){
+    auto &t = *i;
+    // list iterators stay valid through the splice
+    t->_it = i;
+    t->_id = _next_id();
+    // share zones with the tasks already loaded
+    if (t->_tz)
+      t->_tz = _zone(*t->_tz);
   }
+  _tasks.splice(_tasks.end(), tasks);
+  _changed();
+  _wakeup();
+  return loaded;
+}
+
+void CronoS::reload(){
+  std::lock_guard<std::mutex> lock(_mtx);
+  int64_t now_ms = _backend->now_ms();
+  for (auto &t : _tasks)
+    t->_reload = t->valid;
+  _reload_it = _tasks.begin();
+  _reloading = true;
+  // tasks that are due soon are recalculated right away, the rest are left to the scheduler
+  _reload_horizon(now_ms);
+  _changed();
   start();
-}
\ No newline at end of file
+}
+
+CronoS_MemStats CronoS::getMemStats(){
+  return { cronos_mem_bytes.load(), cronos_mem_peak.load(), cronos_mem_allocs.load(), cronos_mem_frees.load(), cronos_mem_tasks.load(), cronos_mem_task_bytes.load() };
+}
+
+void CronoS::resetMemPeak(){
+  cronos_mem_peak.store(cronos_mem_bytes.load());
+}
+
+void CronoS::setPlan(size_t max_entries){
+  std::lock_guard<std::mutex> lock(_mtx);
+  _plan_max = max_entries;
+  _plan_dirty = true;
+  if (!max_entries){
+    _plan.clear();
+    _plan.shrink_to_fit();
+    _plan_stats = {};
+  }
+  _wakeup();
+}
+
+void CronoS::_plan_build(int64_t now_ms){
+  auto started = std::chrono::steady_clock::now();
+  _plan.clear();
+  _plan_pos = 0;
+  _plan_from_ms = now_ms;
+  _plan_end_ms = static_cast<int64_t>(cronos_midnight(static_cast<time_t>(now_ms / 1000))) * 1000;
+  _plan_stats.tasks = _plan_stats.live = 0;
+
+  // fire times of the task within [from, to), tasks in own zone are enumerated with cron_next_tz()
+  auto enumerate = [](CronoS_Task* t, time_t from, time_t to, time_t* buf, int len){
+    if (!t->_tz)
+      return cron_enumerate_between(&t->rule, from, to, buf, len);
+    int n{0};
+    for (time_t x = cron_next_tz(&t->rule, t->_tz.get(), from - 1); n != len && x != CRON_INVALID_INSTANT && x < to; x = cron_next_tz(&t->rule, t->_tz.get(), x))
+      buf[n++] = x;
+    return n;
+  };
+
+  for (auto &t : _tasks){
+    t->_planned = false;
+    if (!t->valid)
+      continue;
+    size_t first = _plan.size();
+    // fire times that are dispatched later than now, same as CronoS_Task::_schedule()
+    int64_t base = now_ms - t->_offset_ms;
+    time_t from = static_cast<time_t>(base >= 0 ? base / 1000 : (base - 999) / 1000) + 1;
+    // task that is already due is planned from it's pending fire time, within the late window
+    if (t->next_run != CRON_INVALID_INSTANT && t->next_run < from)
+      from = std::max(t->next_run, from - 1 - static_cast<time_t>(CRONOS_TASK_MAX_LATE_TIME + t->_slack));
+    from -= t->_spread;
+    time_t to = static_cast<time_t>(_plan_end_ms / 1000) - t->_spread;
+
+    bool fits{true};
+    time_t buf[32];
+    int n;
+    while (fits && from < to && (n = enumerate(t.get(), from, to, buf, 32)) > 0){
+      if (_plan.size() - first + n > CRONOS_PLAN_TASK_MAX || _plan.size() + n > _plan_max){
+        fits = false;
+        break;
+      }
+      for (int k = 0; k != n; ++k)
+        _plan.push_back({static_cast<int32_t>((static_cast<int64_t>(buf[k] + t->_spread) * 1000 + t->_offset_ms) - now_ms), 0, t.get()});
+      from = buf[n - 1] + 1;
+    }
+
+    if (!fits){
+      // evaluate dense task live
+      _plan.resize(first);
+      ++_plan_stats.live;
+      continue;
+    }
+    t->_planned = true;
+    t->_plan_idx = UINT32_MAX;
+    ++_plan_stats.tasks;
+    // no fires till the end of the day
+    if (_plan.size() == first && t->next_run < to + t->_spread)
+      t->_schedule(now_ms);
+  }
+
+  // simultaneous entries are kept in task list order
+  std::stable_sort(_plan.begin(), _plan.end(), [](const plan_entry_t& a, const plan_entry_t& b){ return a.ms < b.ms; });
+  // link entries of the same task
+  for (size_t i = _plan.size(); i--; ){
+    _plan[i].next = _plan[i].task->_plan_idx;
+    _plan[i].task->_plan_idx = static_cast<uint32_t>(i);
+  }
+  for (auto &t : _tasks){
+    if (t->_planned && t->_plan_idx != UINT32_MAX)
+      t->next_run = static_cast<time_t>((_plan_due(_plan[t->_plan_idx]) - t->_offset_ms) / 1000);
+  }
+
+  _plan_dirty = false;
+  _plan_stats.entries = _plan.size();
+  _plan_stats.build_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - started).count();
+  ++_plan_stats.builds;
+}
+
+void CronoS::_reload_horizon(int64_t now_ms){
+  time_t now = static_cast<time_t>(now_ms / 1000);
+  // matching a rule against a few seconds is much cheaper than cron_next()
+  struct tm tms[CRONOS_RELOAD_HORIZON + 1];
+  for (int k = 0; k <= CRONOS_RELOAD_HORIZON; ++k)
+    cronos_tm(now + k, &tms[k]);
+
+  for (auto i = _reload_it; i != _tasks.end(); ++i){
+    CronoS_Task* t = i->get();
+    if (!t->_reload) continue;
+    cron_expr_v2 rule;
+    cron_expr_to_v2(&t->rule, &rule);
+    for (int k = 0; k <= CRONOS_RELOAD_HORIZON; ++k){
+      struct tm tm;
+      // spread tasks fire at rule's time shifted by spread, tasks in own zone are matched in their local time
+      if (t->_tz)
+        cron_time_tz(now + k - t->_spread, t->_tz.get(), &tm);
+      else if (t->_spread)
+        cronos_tm(now + k - t->_spread, &tm);
+      if (cron_match_v2(&rule, t->_spread || t->_tz ? &tm : &tms[k])){
+        t->_reload = false;
+        t->_schedule(now_ms);
+        break;
+      }
+    }
+  }
+  _horizon = now + CRONOS_RELOAD_HORIZON;
+}
+
+void CronoS::_reload_chunk(int64_t now_ms){
+  // extend the horizon before it passes, for the tasks that are still pending
+  if (now_ms / 1000 + 1 >= _horizon)
+    _reload_horizon(now_ms);
+
+  for (size_t n = 0; _reload_it != _tasks.end() && n != CRONOS_RELOAD_CHUNK; ++_reload_it){
+    CronoS_Task* t = _reload_it->get();
+    if (!t->_reload) continue;
+    t->_reload = false;
+    t->_schedule(now_ms);
+    ++n;
+  }
+  if (_reload_it == _tasks.end())
+    _reloading = false;
+}
+
+#ifdef CRONOS_COROUTINES
+CronoS_Awaiter::~CronoS_Awaiter(){
+  if (_cron)
+    _cron->_unlink(this);
+}
+
+void CronoS_Awaiter::_wait(std::coroutine_handle<> h, cronos_tid* id){
+  _h = h;
+  // awaiter could be resumed and destroyed by the scheduler right after linking, do not touch it afterwards
+  _cron->_suspend(this, id);
+}
+
+void CronoS::_suspend(CronoS_Awaiter* a, cronos_tid* id){
+  std::lock_guard<std::mutex> lock(_mtx);
+  // a coroutine awaiting in a loop keeps a single id, so it does not run through the ids shared with the tasks
+  if (id && *id)
+    a->_id = *id;
+  else {
+    a->_id = _next_id();
+    if (id)
+      *id = a->_id;
+  }
+  a->_schedule(_backend->now_ms());
+  a->_link = _awaiters;
+  a->_pending = true;
+  _awaiters = a;
+  _wakeup();
+}
+
+void CronoS::_unlink(CronoS_Awaiter* a){
+  std::lock_guard<std::mutex> lock(_mtx);
+  if (!a->_pending)
+    return;
+  for (CronoS_Awaiter** i = &_awaiters; *i; i = &(*i)->_link){
+    if (*i == a){
+      *i = a->_link;
+      a->_pending = false;
+      return;
+    }
+  }
+}
+
+int64_t CronoS::_resume(int64_t now_ms){
+  CronoS_Awaiter* ready{nullptr};
+  CronoS_Awaiter** tail{&ready};
+  int64_t wakeup{INT64_MAX};
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (CronoS_Awaiter** i = &_awaiters; *i; ){
+      CronoS_Awaiter* a = *i;
+      if (_due(a, now_ms)){
+        // move to the ready list
+        *i = a->_link;
+        a->_pending = false;
+        a->_link = nullptr;
+        *tail = a;
+        tail = &a->_link;
+      } else {
+        // same as for the tasks, recalculate to handle time adjustments
+        a->_schedule(now_ms);
+        i = &a->_link;
+      }
+    }
+  }
+
+  // resume coroutines out of lock, so that those could co_await again
+  while (ready){
+    CronoS_Awaiter* a = ready;
+    // awaiter is destroyed once coroutine proceeds, fetch next one beforehand
+    ready = a->_link;
+    a->cronos_run();
+  }
+
+  // resumed coroutines might be awaiting again
+  std::lock_guard<std::mutex> lock(_mtx);
+  for (auto a = _awaiters; a; a = a->_link){
+    if (a->next_run != CRON_INVALID_INSTANT)
+      wakeup = std::min(wakeup, a->_due_ms());
+  }
+  return wakeup;
+}
+#endif  // CRONOS_COROUTINES
+
+CronoS_Sharded::CronoS_Sharded(unsigned shards){
+#ifdef CRONOS_RTOS
+#ifdef portNUM_PROCESSORS
+  unsigned cores = portNUM_PROCESSORS;
+#else
+  unsigned cores = 1;
+#endif
+#else
+  unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+#endif
+  if (!shards)
+    shards = cores;
+  for (unsigned i = 0; i != shards; ++i){
+#ifdef CRONOS_RTOS
+    _backends.emplace_back(std::make_unique<CronoS_Worker_Backend>(i % cores));
+#else
+    _backends.emplace_back(std::make_unique<CronoS_POSIX_Backend>());
+#endif
+    _shards.emplace_back(std::make_unique<CronoS>(_backends.back().get()));
+    _shards.back()->_ids = &_ids;
+#ifndef CRONOS_RTOS
+    // loop is spawned once the shard is attached to the backend
+    static_cast<CronoS_POSIX_Backend*>(_backends.back().get())->spawn(i % cores);
+#endif
+  }
+}
+
+CronoS_Sharded::~CronoS_Sharded(){
+  stop();
+  // shard's loops must be done before the shards are destroyed
+  for (auto &b : _backends)
+#ifdef CRONOS_RTOS
+    static_cast<CronoS_Worker_Backend*>(b.get())->stop();
+#else
+    static_cast<CronoS_POSIX_Backend*>(b.get())->stop();
+#endif
+}
+
+void CronoS_Sharded::start(){
+  for (auto &s : _shards)
+    s->start();
+}
+
+void CronoS_Sharded::stop(){
+  for (auto &s : _shards)
+    s->stop();
+}
+
+void CronoS_Sharded::reload(){
+  for (auto &s : _shards)
+    s->reload();
+}
+
+cronos_tid CronoS_Sharded::_add(CronoS_Task_pt task, int shard){
+  if (!task) return 0;
+  // id is picked in advance to hash it
+  cronos_tid id = ++_ids;
+  task->_id = id;
+  size_t n = shard < 0 ? cronos_hash(id) % _shards.size() : static_cast<size_t>(shard) % _shards.size();
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _map[id] = n;
+  }
+  return _shards[n]->addTask(std::move(task));
+}
+
+cronos_tid CronoS_Sharded::addCallback(const char* expression, CronoS_Callback_t cb, void* arg, int shard){
+  return _add(std::make_unique<CronoS_Callback>(expression, cb, arg), shard);
+}
+
+cronos_tid CronoS_Sharded::addTask(CronoS_Task_pt task, int shard){
+  return _add(std::move(task), shard);
+}
+
+void CronoS_Sharded::removeTask(cronos_tid id){
+  CronoS* s = find(id);
+  if (!s) return;
+  s->removeTask(id);
+  std::lock_guard<std::mutex> lock(_mtx);
+  _map.erase(id);
+}
+
+bool CronoS_Sharded::moveTask(cronos_tid id, size_t shard){
+  if (shard >= _shards.size()) return false;
+  std::lock_guard<std::mutex> lock(_mtx);
+  CronoS* s = _locate(id);
+  if (!s) return false;
+  if (s == _shards[shard].get()) return true;
+  CronoS_Task_pt task = s->_detach(id);
+  if (!task){
+    // task has been removed from the shard directly
+    _map.erase(id);
+    return false;
+  }
+  _shards[shard]->addTask(std::move(task));
+  _map[id] = shard;
+  return true;
+}
+
+CronoS* CronoS_Sharded::find(cronos_tid id){
+  std::lock_guard<std::mutex> lock(_mtx);
+  return _locate(id);
+}
+
+CronoS* CronoS_Sharded::_locate(cronos_tid id){
+  auto i = _map.find(id);
+  if (i != _map.end())
+    return _shards[i->second].get();
+  // task has been added to a shard directly
+  for (size_t n = 0; n != _shards.size(); ++n){
+    CronoS &s = *_shards[n];
+    std::lock_guard<std::mutex> lock(s._mtx);
+    if (s._find(id)){
+      _map[id] = n;
+      return &s;
+    }
+  }
+  return nullptr;
+}
+
+CronoS_Stats CronoS_Sharded::getStats() const {
+  CronoS_Stats total{};
+  for (auto &s : _shards){
+    CronoS_Stats st = s->getStats();
+    total.wakeups += st.wakeups;
+    total.evaluations += st.evaluations;
+    total.runs += st.runs;
+    total.skipped += st.skipped;
+    total.queued += st.queued;
+    total.overruns += st.overruns;
+    total.throttled += st.throttled;
+  }
+  return total;
+}
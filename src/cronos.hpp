@@ -6,15 +6,99 @@ Copyright (C) Emil Muratov, 2024
 GitHub: https://github.com/vortigont/CronoS
 */
 
+// RTOS timer backend and RTOS delivery tasks are available when FreeRTOS headers are, define CRONOS_NO_RTOS to build without them
+#if !defined(CRONOS_NO_RTOS) && __has_include("freertos/FreeRTOS.h")
 #include "freertos/FreeRTOS.h"
 #include "freertos/timers.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#define CRONOS_RTOS
+#endif
 #include <list>
+#include <vector>
+#include <unordered_map>
 #include <memory>
+#include <atomic>
 #include <mutex>
 #include <functional>
+#if !defined(CRONOS_RTOS) && !defined(__linux__)
+#error "CronoS needs either FreeRTOS or Linux timerfd backend"
+#endif
+#ifdef __linux__
+#include <thread>
+#endif
 #include "ccronexpr.h"
 
+// C++20 coroutines support, CronoS::next() awaitable is available with coroutine-enabled toolchains
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#define CRONOS_COROUTINES
+#endif
+
 using cronos_tid = uint32_t;
+// task group id, 0 - no group
+using cronos_gid = uint32_t;
+
+/**
+ * @brief memory counters, library-wide for all scheduler instances
+ * counted are task objects and all scheduler's containers: task lists, snapshots, fire plan, groups and zones.
+ * Heap storage of the callbacks' captures (std::function) is not counted
+ */
+struct CronoS_MemStats {
+  // bytes currently allocated
+  size_t bytes;
+  // high-water mark of allocated bytes
+  size_t peak;
+  // number of allocations and deallocations
+  uint32_t allocs;
+  uint32_t frees;
+  // number of task objects and bytes they take, without list nodes
+  uint32_t tasks;
+  size_t task_bytes;
+};
+
+// counted allocation, see CronoS_MemStats
+void* cronos_alloc(size_t size);
+// counted deallocation
+void cronos_free(void* ptr, size_t size);
+
+/**
+ * @brief counting allocator for scheduler's containers
+ * 
+ * @tparam T value type
+ */
+template <typename T>
+struct CronoS_Allocator {
+  using value_type = T;
+
+  CronoS_Allocator() = default;
+  template <typename U>
+  CronoS_Allocator(const CronoS_Allocator<U>&) noexcept {}
+
+  T* allocate(size_t n){ return static_cast<T*>(cronos_alloc(n * sizeof(T))); }
+  void deallocate(T* p, size_t n) noexcept { cronos_free(p, n * sizeof(T)); }
+
+  template <typename U>
+  bool operator==(const CronoS_Allocator<U>&) const noexcept { return true; }
+  template <typename U>
+  bool operator!=(const CronoS_Allocator<U>&) const noexcept { return false; }
+};
+
+/**
+ * @brief overlap policy, what to do with a firing when previous runs of the task are still in flight
+ * 
+ */
+enum class CronoS_Overlap : uint8_t {
+  // run up to a given number of concurrent instances, extra firings are skipped
+  allow = 0,
+  // skip the firing if previous run is still in flight
+  skip,
+  // queue at most one pending run, it is dispatched once previous run is done
+  queue
+};
 
 /**
  * @brief An abstract CronoS task
@@ -22,20 +106,84 @@ using cronos_tid = uint32_t;
  */
 class CronoS_Task {
 friend class CronoS;
+friend class CronoS_Sharded;
   // task id
   cronos_tid _id{0};
+  // spread offset in seconds, fire times are shifted by this value
+  uint32_t _spread{0};
+  // sub-second offset in milliseconds, task is dispatched at next_run + offset
+  uint16_t _offset_ms{0};
+  // tolerance window in seconds, task could be dispatched late for this time to coalesce wakeups with other tasks
+  uint32_t _slack{0};
+  // next_run is pending recalculation after reload()
+  bool _reload{false};
+  // task's fire times are taken from the daily plan
+  bool _planned{false};
+  // index of task's first plan entry, used while building the plan
+  uint32_t _plan_idx{0};
+  // dispatch priority class, when several tasks are due higher priority runs first
+  uint8_t _priority{0};
+  // deadline budget in ms, due tasks of the same priority run in order of fire time + budget, 0 - task's late window
+  uint32_t _budget_ms{0};
+  // fire time of a firing pending dispatch, ms since epoch, -1 - none
+  int64_t _ready_ms{-1};
+  // overlap policy
+  CronoS_Overlap _overlap{CronoS_Overlap::allow};
+  // max runs in flight, 0 - runs are not tracked
+  uint8_t _max_inflight{0};
+  // runs dispatched and not reported done yet
+  uint8_t _inflight{0};
+  // a run is queued until previous one is done
+  bool _queued{false};
+  // timezone rule the expression is evaluated in, nullptr - process-wide timezone
+  std::shared_ptr<const cron_tz> _tz;
+  // callback time budget of a single run in us, 0 - runs are not checked
+  uint32_t _run_budget_us{0};
+  // budget overruns after which task is demoted, and then disabled, 0 - never
+  uint8_t _max_overruns{0};
+  // budget overruns since the last demotion
+  uint8_t _overruns{0};
+  // 0 - task is in good standing, 1 - demoted for overrunning it's budget, 2 - disabled
+  uint8_t _demoted{0};
+  // number of task runs
+  uint32_t _runs{0};
+  // group the task belongs to
+  cronos_gid _group{0};
+  // intrusive links of the group's task list
+  CronoS_Task* _gprev{nullptr};
+  CronoS_Task* _gnext{nullptr};
+  // task is disabled, it is kept in the list of disabled tasks out of evaluation
+  bool _disabled{false};
+  // task's position in scheduler's list of tasks, enabled or disabled one
+  std::list< std::unique_ptr<CronoS_Task>, CronoS_Allocator< std::unique_ptr<CronoS_Task> > >::iterator _it;
+
+  // calculate next_run, a fire time with spread applied which is dispatched later than 'now_ms', time in ms since epoch
+  void _schedule(int64_t now_ms);
+
+  // dispatch time in ms since epoch
+  int64_t _due_ms() const { return static_cast<int64_t>(next_run) * 1000 + _offset_ms; }
+
 protected:
   time_t next_run{};
   cron_expr rule{};
   bool valid;
 
 public:
+  // task objects are counted in CronoS_MemStats
+  static void* operator new(size_t size);
+  static void operator delete(void* ptr, size_t size);
+
   explicit CronoS_Task(const char* expression);
+  // create task from already parsed expression
+  explicit CronoS_Task(const cron_expr& expr) : rule(expr), valid(true) {}
   virtual ~CronoS_Task(){}
 
   // get task id
   cronos_tid getID() const { return _id; }
 
+  // get task's priority class
+  uint8_t getPriority() const { return _priority; }
+
   const cron_expr& getExpr() const { return rule; }
 
   // set/update Task's cron expression
@@ -50,6 +198,22 @@ public:
 };
 
 using CronoS_Task_pt = std::unique_ptr<CronoS_Task>;
+using CronoS_TaskList = std::list< CronoS_Task_pt, CronoS_Allocator<CronoS_Task_pt> >;
+
+#ifdef CRONOS_RTOS
+/**
+ * @brief RTOS priority for a worker task that executes jobs of given priority class
+ * jobs that hand their work off to worker tasks (i.e. via CronoS_Notify or CronoS_Queue)
+ * could create workers with this priority, so that classes order the execution the same way as the dispatch
+ * 
+ * @param priority task's priority class, see CronoS::setPriority()
+ * @return UBaseType_t RTOS task priority, capped to configMAX_PRIORITIES - 1
+ */
+inline UBaseType_t cronos_rtos_priority(uint8_t priority){
+  return tskIDLE_PRIORITY + 1 + priority < configMAX_PRIORITIES ? tskIDLE_PRIORITY + 1 + priority : configMAX_PRIORITIES - 1;
+}
+#endif  // CRONOS_RTOS
+
 // type for the CallBack function
 using CronoS_Callback_t = std::function<void(cronos_tid id, void* arg)>;
 
@@ -70,6 +234,7 @@ protected:
 
 public:
   CronoS_Callback(const char* expression, CronoS_Callback_t f, void* arg = nullptr) : CronoS_Task(expression), callback(f), _arg(arg) {}
+  CronoS_Callback(const cron_expr& expr, CronoS_Callback_t f, void* arg = nullptr) : CronoS_Task(expr), callback(f), _arg(arg) {}
 
   /*!
    * @copydoc CronoS_Task::cronos_run()
@@ -78,22 +243,716 @@ public:
   void cronos_run() override { if (callback) callback(getID(), _arg); }
 };
 
+#ifdef CRONOS_RTOS
+/**
+ * @brief CronoS task that delivers a firing as an RTOS task notification
+ * no user code is executed in scheduler's context, notified task is woken up directly
+ * 
+ */
+class CronoS_Notify : public CronoS_Task {
+protected:
+  TaskHandle_t _task;
+  uint32_t _value;
+  eNotifyAction _action;
+
+public:
+  /**
+   * @brief Construct a new CronoS_Notify object
+   * 
+   * @param expression crontab scheduling rule string
+   * @param task handle of the task to notify
+   * @param value notification value, i.e. bits to set for the default eSetBits action
+   * @param action notify action, see xTaskNotify()
+   */
+  CronoS_Notify(const char* expression, TaskHandle_t task, uint32_t value, eNotifyAction action = eSetBits) : CronoS_Task(expression), _task(task), _value(value), _action(action) {}
+
+  /*!
+   * @copydoc CronoS_Task::cronos_run()
+   * 
+   */
+  void cronos_run() override { xTaskNotify(_task, _value, _action); }
+};
+
+/**
+ * @brief CronoS task that delivers a firing by posting a fixed-size item to an RTOS queue
+ * an item is copied to the queue by value, scheduler never blocks on a full queue, a firing is dropped instead
+ * 
+ * @tparam T queue item type, must match the item size of the queue
+ */
+template <typename T>
+class CronoS_Queue : public CronoS_Task {
+protected:
+  QueueHandle_t _queue;
+  T _item;
+
+public:
+  /**
+   * @brief Construct a new CronoS_Queue object
+   * 
+   * @param expression crontab scheduling rule string
+   * @param queue queue handle to post to
+   * @param item an item to post on each firing
+   */
+  CronoS_Queue(const char* expression, QueueHandle_t queue, const T& item) : CronoS_Task(expression), _queue(queue), _item(item) {}
+
+  /*!
+   * @copydoc CronoS_Task::cronos_run()
+   * 
+   */
+  void cronos_run() override { xQueueSend(_queue, &_item, 0); }
+};
+#endif  // CRONOS_RTOS
+
+#ifdef __linux__
+/**
+ * @brief CronoS task that delivers a firing by writing to an eventfd or a pipe (host builds)
+ * an 8 byte counter value of 1 is written, so it is usable with eventfd() descriptors,
+ * descriptor should be opened in non-blocking mode to never block the scheduler
+ * 
+ */
+class CronoS_FD : public CronoS_Task {
+protected:
+  int _fd;
+
+public:
+  CronoS_FD(const char* expression, int fd) : CronoS_Task(expression), _fd(fd) {}
+
+  /*!
+   * @copydoc CronoS_Task::cronos_run()
+   * 
+   */
+  void cronos_run() override;
+};
+#endif  // __linux__
+
+#ifdef CRONOS_COROUTINES
+class CronoS;
+
+/**
+ * @brief a minimal detached coroutine type to write CronoS jobs as coroutines
+ * coroutine starts immidiately on call and destroys it's frame when finished
+ */
+struct CronoS_Coro {
+  struct promise_type {
+    // id of the coroutine's awaiters, taken on the first co_await and reused by the next ones
+    cronos_tid cronos_id{0};
+
+    CronoS_Coro get_return_object() noexcept { return {}; }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() noexcept {}
+    void unhandled_exception() noexcept { std::terminate(); }
+  };
+};
+
+// awaiter id kept in the promise of the awaiting coroutine, promise types without a cronos_id member take a new id per co_await
+template <class P, class = void>
+struct cronos_frame_id { static cronos_tid* get(P&){ return nullptr; } };
+template <class P>
+struct cronos_frame_id<P, std::void_t<decltype(std::declval<P&>().cronos_id)>> { static cronos_tid* get(P& p){ return &p.cronos_id; } };
+
+/**
+ * @brief an awaitable CronoS task that resumes a coroutine when it's cron expression fires
+ * created by CronoS::next() and lives in the awaiting coroutine's frame, so
+ * waiting does not allocate anything on heap.
+ * Coroutine is resumed from the scheduler's context, same as callbacks
+ * co_await returns fire time or CRON_INVALID_INSTANT if expression is malformed
+ * (then coroutine is not suspended at all)
+ */
+class CronoS_Awaiter : public CronoS_Task {
+friend class CronoS;
+  CronoS* _cron;
+  std::coroutine_handle<> _h{};
+  // intrusive link for the list of pending awaiters
+  CronoS_Awaiter* _link{nullptr};
+  // awaiter is linked to the scheduler
+  bool _pending{false};
+
+  // link to the scheduler, 'id' - awaiter id kept by the coroutine's frame, if any
+  void _wait(std::coroutine_handle<> h, cronos_tid* id);
+
+public:
+  CronoS_Awaiter(CronoS* cron, const char* expression) : CronoS_Task(expression), _cron(cron) {}
+  ~CronoS_Awaiter();
+
+  bool await_ready() const noexcept { return !valid; }
+  template <class P>
+  void await_suspend(std::coroutine_handle<P> h){ _wait(h, cronos_frame_id<P>::get(h.promise())); }
+  time_t await_resume() const noexcept { return valid ? next_run : CRON_INVALID_INSTANT; }
+
+  /*!
+   * @copydoc CronoS_Task::cronos_run()
+   * 
+   */
+  void cronos_run() override { if (_h) _h.resume(); }
+};
+
+#endif  // CRONOS_COROUTINES
+
+
+
+/**
+ * @brief clock and timer interface for the scheduler
+ * scheduler reads time and arms it's wakeups only via backend,
+ * backend must call fire() when armed timer expires
+ */
+class CronoS_Backend {
+  // scheduler's evaluation function
+  std::function<void()> _fire;
+  // scheduler's clock step handler
+  std::function<void()> _step;
+  // handlers are called under the lock, so that rebinding waits for the call in progress
+  std::mutex _mtx;
+
+protected:
+  // run scheduler's evaluation, to be called by derived backends when timer expires
+  void fire(){ std::lock_guard<std::mutex> lock(_mtx); if (_fire) _fire(); }
+
+  // reevaluate scheduler's rules, to be called by derived backends that are notified of clock steps
+  void stepped(){ std::lock_guard<std::mutex> lock(_mtx); if (_step) _step(); }
+
+public:
+  virtual ~CronoS_Backend(){}
+
+  // bind to the scheduler, called by CronoS, nullptr - unbind. Must not be called from the handlers
+  void attach(std::function<void()> f, std::function<void()> step = nullptr){
+    std::lock_guard<std::mutex> lock(_mtx);
+    _fire = f;
+    _step = step;
+  }
+
+  // current time in ms since epoch
+  virtual int64_t now_ms() = 0;
+
+  // (re)arm timer to fire after 'ms' milliseconds, 0 - asap
+  virtual void arm(int64_t ms) = 0;
+
+  // stop the timer
+  virtual void disarm() = 0;
+
+  // max time between evaluations, scheduler polls the clock to catch time adjustments
+  virtual int64_t max_sleep_ms() const;
+
+  // clock flows in real time, so it's steps could be traced against the monotonic clock
+  virtual bool realtime() const { return true; }
+};
+
+#ifdef CRONOS_RTOS
+/**
+ * @brief default backend, system clock and FreeRTOS software timer
+ * scheduler is evaluated in RTOS timer daemon task
+ */
+class CronoS_RTOS_Backend : public CronoS_Backend {
+  TimerHandle_t _tmr{nullptr};
+
+public:
+  ~CronoS_RTOS_Backend();
+
+  int64_t now_ms() override;
+  void arm(int64_t ms) override;
+  void disarm() override;
+};
+
+/**
+ * @brief backend with own RTOS task, system clock and task notifications
+ * scheduler is evaluated in the backend's task instead of the timer daemon, so it runs in parallel with other schedulers,
+ * on multi-core chips the task could be pinned to a core, see CronoS_Sharded. Scheduler must be stopped before destruction
+ */
+class CronoS_Worker_Backend : public CronoS_Backend {
+  // guards the task handle, so that it is not notified while being deleted
+  std::mutex _lock;
+  TaskHandle_t _task{nullptr};
+  // armed deadline, ms since epoch, -1 - disarmed
+  std::atomic<int64_t> _deadline{-1};
+  // loop is asked to quit, and has quit
+  std::atomic<bool> _quit{false};
+  std::atomic<bool> _done{false};
+
+  static void _loop(void* arg);
+
+public:
+  /**
+   * @brief Construct a new worker backend
+   * 
+   * @param core core to pin the task to, -1 - no affinity (ESP-IDF only, ignored on other ports)
+   * @param priority task priority, timer daemon's priority by default
+   * @param stack task stack size
+   */
+  explicit CronoS_Worker_Backend(int core = -1, UBaseType_t priority = configTIMER_TASK_PRIORITY, uint32_t stack = 4096);
+  ~CronoS_Worker_Backend();
+
+  /**
+   * @brief stop backend's task and wait till it quits
+   * scheduler's evaluation in progress is finished first, so the scheduler could be destroyed afterwards.
+   * Must not be called from the scheduler's callbacks
+   */
+  void stop();
+
+  int64_t now_ms() override;
+  void arm(int64_t ms) override;
+  void disarm() override;
+};
+#endif  // CRONOS_RTOS
+
+#ifdef __linux__
+/**
+ * @brief simulated clock backend for host builds
+ * time does not flow by itself, run() jumps straight to the next armed deadline
+ * and evaluates the scheduler in the caller's thread, so long schedules
+ * could be replayed in a fraction of real time. Scheduler's tasks are run from run() as well
+ * 
+ */
+class CronoS_SimBackend : public CronoS_Backend {
+  int64_t _now;
+  // armed deadline, -1 if disarmed
+  int64_t _deadline{-1};
+
+public:
+  /**
+   * @brief Construct a new simulated backend
+   * 
+   * @param start_ms initial time in ms since epoch
+   */
+  explicit CronoS_SimBackend(int64_t start_ms = 0) : _now(start_ms) {}
+
+  int64_t now_ms() override { return _now; }
+  void arm(int64_t ms) override { _deadline = _now + (ms > 0 ? ms : 0); }
+  void disarm() override { _deadline = -1; }
+  // there is no clock drift to catch in simulation, just wake up daily
+  int64_t max_sleep_ms() const override { return 86400000; }
+  bool realtime() const override { return false; }
+
+  /**
+   * @brief advance time up to 'until_ms' firing armed timer on the way
+   * 
+   * @param until_ms time in ms since epoch to stop at
+   * @return uint64_t number of timer firings
+   */
+  uint64_t run(int64_t until_ms);
+
+  /**
+   * @brief step the clock to a new time, as with SNTP adjustment
+   * armed timer keeps it's remaining delay, same as RTOS tick-based timer does,
+   * CronoS::reload() should be called afterwards same as on a real clock step
+   * 
+   * @param ms new time in ms since epoch
+   */
+  void setTime(int64_t ms);
+};
+
+/**
+ * @brief native Linux backend, system clock and timerfd
+ * timer is armed on CLOCK_REALTIME at absolute time with TFD_TIMER_CANCEL_ON_SET,
+ * so clock steps (SNTP, settimeofday) are reported by the kernel and the scheduler is reloaded right away,
+ * there is no need to poll the clock or call CronoS::reload() on time adjustments.
+ * Timer descriptor could be added to an existing event loop, see fd() and dispatch(),
+ * or the backend could run it's own epoll loop, see run() and spawn().
+ * Default backend for the builds without RTOS
+ */
+class CronoS_POSIX_Backend : public CronoS_Backend {
+  // timer descriptor
+  int _tfd{-1};
+  // epoll and stop event descriptors for the own loop
+  int _epfd{-1};
+  int _efd{-1};
+  std::atomic<bool> _stop{false};
+  std::thread _thread;
+
+  // create epoll and stop event descriptors, spawn() does it before the loop's thread is started, so stop() could signal it
+  bool _open_loop();
 
+public:
+  CronoS_POSIX_Backend();
+  ~CronoS_POSIX_Backend();
+
+  int64_t now_ms() override;
+  void arm(int64_t ms) override;
+  void disarm() override;
+  // clock steps are notified by the kernel, just wake up daily
+  int64_t max_sleep_ms() const override { return 86400000; }
+
+  /**
+   * @brief timer descriptor to be watched for readability (EPOLLIN/POLLIN) by an external event loop
+   * 
+   * @return int descriptor, -1 if timerfd could not be created
+   */
+  int fd() const { return _tfd; }
+
+  /**
+   * @brief handle timer descriptor readability, to be called by an external event loop
+   * evaluates the scheduler if timer has expired or reloads it if the clock has been stepped
+   * 
+   */
+  void dispatch();
+
+  /**
+   * @brief run own epoll loop in the caller's thread until stop() is called
+   * 
+   * @return int 0 on stop, -1 on error
+   */
+  int run();
+
+  /**
+   * @brief run own epoll loop in a new thread
+   * 
+   * @param core CPU to pin the thread to, -1 - no affinity
+   */
+  void spawn(int core = -1);
+
+  /**
+   * @brief stop own loop, thread started with spawn() is joined
+   * 
+   */
+  void stop();
+};
+#endif  // __linux__
+
+/**
+ * @brief scheduler counters
+ * 
+ */
+struct CronoS_Stats {
+  // timer wakeups, excluding yields between the runs of simultaneous tasks
+  uint32_t wakeups;
+  // total number of evaluations, including yields
+  uint32_t evaluations;
+  // number of task runs
+  uint32_t runs;
+  // firings skipped due to overlap policy
+  uint32_t skipped;
+  // firings queued behind a run in flight
+  uint32_t queued;
+  // runs that took longer than task's run budget
+  uint32_t overruns;
+  // dispatches deferred due to exhausted callback time quota
+  uint32_t throttled;
+};
+
+/**
+ * @brief a copy of task's scheduling state, an element of the task table snapshot
+ * 
+ */
+struct CronoS_TaskInfo {
+  cronos_tid id;
+  cron_expr rule;
+  uint32_t spread;
+  uint32_t slack;
+  uint16_t offset_ms;
+  uint8_t priority;
+  uint32_t budget_ms;
+  CronoS_Overlap overlap;
+  uint8_t max_inflight;
+  // timezone rule, nullptr - process-wide timezone
+  std::shared_ptr<const cron_tz> tz;
+  uint32_t run_budget_us;
+  uint8_t max_overruns;
+  // 0 - task is in good standing, 1 - demoted for overrunning it's budget, 2 - disabled
+  uint8_t demoted;
+  cronos_gid group;
+  bool enabled;
+  bool valid;
+};
+
+// immutable task table snapshot, shared between the readers
+using CronoS_Snapshot = std::vector< CronoS_TaskInfo, CronoS_Allocator<CronoS_TaskInfo> >;
+using CronoS_Snapshot_pt = std::shared_ptr<const CronoS_Snapshot>;
+
+/**
+ * @brief daily fire plan counters
+ * 
+ */
+struct CronoS_PlanStats {
+  // number of entries in current plan
+  uint32_t entries;
+  // tasks that are dispatched from the plan
+  uint32_t tasks;
+  // tasks that are too dense to fit into the plan and are evaluated live
+  uint32_t live;
+  // time it took to build current plan, us
+  uint32_t build_us;
+  // number of plan builds
+  uint32_t builds;
+};
+
+/**
+ * @brief scheduler trace event types, see CronoS::dumpTrace()
+ * 
+ */
+enum class CronoS_TraceEvent : uint8_t {
+  // timer wakeup, value - 1 if it is a yield between the runs
+  wakeup = 1,
+  // task is marked pending, value - ms past it's fire time
+  due,
+  // task run started
+  run_start,
+  // task run ended, value - run time in us
+  run_end,
+  // task's next run time is calculated, value - next run time, low 32 bits
+  next_run,
+  // timer is armed, value - delay in ms
+  arm,
+  // clock step, value - step in ms, 0 if reported by the backend
+  time_jump
+};
+
+/**
+ * @brief trace ring buffer element
+ * 
+ */
+struct CronoS_TraceEntry {
+  // monotonic time in us, wraps around every ~71 minutes
+  uint32_t ts_us;
+  cronos_tid id;
+  // event specific value
+  int32_t value;
+  CronoS_TraceEvent event;
+  uint8_t reserved[3];
+};
+
+#ifndef CRONOS_TRACE_SIZE
+#define CRONOS_TRACE_SIZE           256   // number of trace ring buffer entries, must be a power of 2
+#endif
+
+/**
+ * @brief sizes of scheduler's data structures in this build, see CronoS::footprint()
+ * 
+ */
+struct CronoS_Footprint {
+  // base task object, including vtable pointer
+  size_t task;
+  // callback task object, the one created by addCallback(), loadImage() and loadCrontab()
+  size_t callback;
+  // parsed cron expression, a part of each task object
+  size_t expr;
+  // callback functor, a part of callback task object
+  size_t function;
+  // task list node, one per task, link pointers and the task pointer
+  size_t list_node;
+  // compiled timezone rule, one per distinct zone
+  size_t tz;
+  // task table snapshot element, one per task
+  size_t snapshot_entry;
+  // daily fire plan entry, one per planned firing
+  size_t plan_entry;
+  // scheduler object itself
+  size_t scheduler;
+};
+
+/**
+ * @brief binder function for tasks restored from a binary image
+ * should set callback and it's argument for a task with given id and return true,
+ * or return false to skip the task
+ */
+using CronoS_Binder_t = std::function<bool(cronos_tid id, CronoS_Callback_t& cb, void*& arg)>;
+
+/**
+ * @brief resolver function for jobs loaded from crontab text
+ * should set callback and it's argument for a job name and return true,
+ * or return false if job name is unknown
+ * @note job name is not nul-terminated, it is a slice of crontab text
+ */
+using CronoS_Resolver_t = std::function<bool(const char* name, size_t len, CronoS_Callback_t& cb, void*& arg)>;
+
+/**
+ * @brief crontab loader error reporting function
+ * @param line line number, starting from 1
+ * @param err error message string literal
+ */
+using CronoS_LoadError_t = std::function<void(unsigned line, const char* err)>;
+
+/**
+ * @brief run budget overrun reporting function
+ * @param id task id
+ * @param duration_us time the run took, us
+ */
+using CronoS_Overrun_t = std::function<void(cronos_tid id, uint32_t duration_us)>;
 
 class CronoS {
+#ifdef CRONOS_COROUTINES
+friend class CronoS_Awaiter;
+#endif
+friend class CronoS_Sharded;
 private:
   // mutex protects the access to tasks list container
-  std::mutex _mtx;
+  mutable std::mutex _mtx;
   // counter to generate sequence num for task ids
   uint32_t _cnt{0};
+  // counter shared by the shards of CronoS_Sharded, so that task ids are unique across the shards, nullptr - use own one
+  std::atomic<uint32_t>* _ids{nullptr};
   // a container that holds all scheduled tasks
-  std::list< CronoS_Task_pt > _tasks;
-  // RTOS timer to schedule task runs
-  TimerHandle_t    _tmr{nullptr};
+  CronoS_TaskList _tasks;
+  // disabled tasks, those are never evaluated
+  CronoS_TaskList _disabled;
+  // heads of intrusive task lists of the groups
+  std::unordered_map< cronos_gid, CronoS_Task*, std::hash<cronos_gid>, std::equal_to<cronos_gid>, CronoS_Allocator< std::pair<const cronos_gid, CronoS_Task*> > > _groups;
+  // default clock and timer backend, created only if none is given to the constructor
+#ifdef CRONOS_RTOS
+  std::unique_ptr<CronoS_RTOS_Backend> _default;
+#else
+  std::unique_ptr<CronoS_POSIX_Backend> _default;
+#endif
+  // backend in use
+  CronoS_Backend* _backend;
+  // scheduler is started, set from user's context and read from backend's one
+  std::atomic<bool> _running{false};
+  // timer is armed to yield between the runs
+  std::atomic<bool> _yield{false};
+  // tasks found pending by the last full evaluation, yields between the runs of simultaneous tasks dispatch from it
+  std::vector< CronoS_Task*, CronoS_Allocator<CronoS_Task*> > _pending;
+  // counters of CronoS_Stats, bumped from backend's context while read and reset from any thread
+  struct {
+    std::atomic<uint32_t> wakeups{0}, evaluations{0}, runs{0}, skipped{0}, queued{0}, overruns{0}, throttled{0};
+  } _stats;
+  // task table snapshot for lock-free readers, replaced on each change
+#ifdef __cpp_lib_atomic_shared_ptr
+  std::atomic<CronoS_Snapshot_pt> _snapshot{std::allocate_shared<CronoS_Snapshot>(CronoS_Allocator<CronoS_Snapshot>())};
+#else
+  CronoS_Snapshot_pt _snapshot{std::allocate_shared<CronoS_Snapshot>(CronoS_Allocator<CronoS_Snapshot>())};
+#endif
+  // earliest dispatch time of the tasks as of the last evaluation or task table change, ms since epoch, -1 - none
+  std::atomic<int64_t> _deadline_ms{-1};
+  // reload() is in progress, tasks starting from _reload_it are recalculated in chunks
+  bool _reloading{false};
+  CronoS_TaskList::iterator _reload_it;
+  // tasks pending reload are checked to not fire before this time
+  time_t _horizon{0};
+
+  // daily fire plan entry
+  struct plan_entry_t {
+    // dispatch time, ms since plan start
+    int32_t ms;
+    // index of next entry of the same task
+    uint32_t next;
+    CronoS_Task* task;
+  };
+  // fire plan till the end of the day, sorted by dispatch time
+  std::vector< plan_entry_t, CronoS_Allocator<plan_entry_t> > _plan;
+  // max plan size, 0 - plan is disabled
+  size_t _plan_max{0};
+  // next plan entry to dispatch
+  size_t _plan_pos{0};
+  // plan covers [_plan_from_ms, _plan_end_ms) time range
+  int64_t _plan_from_ms{0};
+  int64_t _plan_end_ms{0};
+  // last evaluation time, to detect clock steps back
+  int64_t _plan_seen_ms{0};
+  // task table has changed, plan must be rebuilt
+  bool _plan_dirty{true};
+  CronoS_PlanStats _plan_stats{};
+  // compiled timezone rules, shared by the tasks in the same zone
+  std::vector< std::shared_ptr<const cron_tz>, CronoS_Allocator< std::shared_ptr<const cron_tz> > > _zones;
+  // callback time quota per second, us, 0 - unlimited
+  uint32_t _cpu_quota_us{0};
+  // callback time spent within the current quota window
+  uint32_t _cpu_used_us{0};
+  // start of the quota window, ms since epoch
+  int64_t _cpu_window_ms{0};
+  CronoS_Overrun_t _onoverrun;
+  // id of the task being run, 0 - none, and the time it's run has started, us of monotonic clock
+  std::atomic<cronos_tid> _run_id{0};
+  std::atomic<uint32_t> _run_started_us{0};
+#ifdef CRONOS_TRACE
+  // trace ring buffer and the index of the next entry
+  CronoS_TraceEntry _trace_buf[CRONOS_TRACE_SIZE];
+  std::atomic<uint32_t> _trace_head{0};
+  // backend and monotonic time of the previous evaluation, to detect clock steps
+  int64_t _trace_now_ms{0};
+  int64_t _trace_mono_us{0};
+
+  // record trace event
+  void _trace(CronoS_TraceEvent event, cronos_tid id, int32_t value);
+#endif
+#ifdef CRONOS_COROUTINES
+  // intrusive list of coroutines awaiting for their rules to fire
+  CronoS_Awaiter* _awaiters{nullptr};
+
+  // link awaiter to the scheduler, 'id' - awaiter id kept by the coroutine's frame, 0 - not taken yet, nullptr - none
+  void _suspend(CronoS_Awaiter* a, cronos_tid* id);
+  // unlink awaiter from the scheduler
+  void _unlink(CronoS_Awaiter* a);
+  // resume coroutines that are due to run, returns earliest dispatch time of pending awaiters
+  int64_t _resume(int64_t now_ms);
+#endif
+
+  // check if task is due to run at time 'now_ms', ms since epoch
+  static bool _due(const CronoS_Task* t, int64_t now_ms);
+
+  // check if pending firing of task 'a' should be dispatched before the one of task 'b'
+  static bool _before(const CronoS_Task* a, const CronoS_Task* b);
+
+  // check task's overlap policy before a run, returns true if task could be run
+  bool _admit(CronoS_Task* t);
+
+  // run the task timing it against it's run budget
+  void _run(CronoS_Task* t);
+
+  // callback time quota is exhausted at 'now_ms', returns time in ms to the end of the quota window or 0
+  int64_t _throttle(int64_t now_ms);
+
+  // get a shared compiled timezone rule, must be called under lock
+  std::shared_ptr<const cron_tz> _zone(const cron_tz& tz);
+
+  // find task by id
+  CronoS_Task* _find(cronos_tid id);
+
+  // generate new task id
+  cronos_tid _next_id(){ return _ids ? ++*_ids : ++_cnt; }
+
+  // make sure ids generated later are above 'id', i.e. the id counter of a loaded image
+  void _seen_id(cronos_tid id);
+
+  // take the task out of the scheduler keeping it's id and options, returns nullptr if there is no such task
+  CronoS_Task_pt _detach(cronos_tid id);
+
+  // add task to the group's list, task must not be in any group
+  void _group_link(CronoS_Task* t, cronos_gid group);
+
+  // remove task from it's group's list
+  void _group_unlink(CronoS_Task* t);
+
+  // remove task from the scheduler
+  void _erase(CronoS_Task* t);
+
+  // move task to the list of disabled tasks
+  void _disable(CronoS_Task* t);
+
+  // move task back to the list of enabled tasks
+  void _enable(CronoS_Task* t, int64_t now_ms);
+
+  // scheduler has nothing to evaluate
+  bool _idle() const;
+
+  // trigger evaluation asap if scheduler is started
+  void _wakeup();
+
+  // publish a new task table snapshot, must be called under lock
+  void _publish();
+
+  // task table has been changed, publish snapshot and invalidate the plan, must be called under lock
+  void _changed();
+
+  // build daily fire plan starting from 'now_ms'
+  void _plan_build(int64_t now_ms);
+
+  // dispatch time of plan entry, ms since epoch
+  int64_t _plan_due(const plan_entry_t& e) const { return _plan_from_ms + e.ms; }
+
+  // recalculate pending tasks that fire within the next CRONOS_RELOAD_HORIZON seconds
+  void _reload_horizon(int64_t now_ms);
+
+  // recalculate next chunk of tasks pending reload
+  void _reload_chunk(int64_t now_ms);
 
   void _evaluate();
 
 public:
+  /**
+   * @brief Construct a new CronoS scheduler
+   * 
+   * @param backend clock and timer backend, it must outlive the scheduler,
+   * if nullptr then system clock and RTOS timer are used, or timerfd running in own thread for the builds without RTOS
+   */
+  explicit CronoS(CronoS_Backend* backend = nullptr);
   ~CronoS();
 
   /**
@@ -111,7 +970,10 @@ public:
   /**
    * @brief starts the scheduler and reevaluate all loaded rules
    * this method MUST be called in case of significant system date/time changes
-   * to reevaluate loaded rules immidiately
+   * to reevaluate loaded rules immidiately.
+   * Only the tasks that fire within the next few seconds are recalculated right away,
+   * the rest are recalculated by the scheduler in chunks of CRONOS_RELOAD_CHUNK tasks
+   * yielding between the chunks, so reload does not block for long with large task tables
    * 
    */
   void reload();
@@ -128,9 +990,49 @@ public:
    * 
    * @param expression crontab scheduling rule string 
    * @param cb functional callback to execute
-   * @return cronos_tid is a Task ID that identifies the task in the scheduler 
+   * @param slack tolerance window in seconds, see setSlack()
+   * @param tz POSIX TZ string the expression is evaluated in, see setTZ()
+   * @return cronos_tid is a Task ID that identifies the task in the scheduler, 0 - TZ string is invalid
+   */
+  cronos_tid addCallback(const char* expression, CronoS_Callback_t cb, void* arg = nullptr, uint32_t slack = 0, const char* tz = nullptr);
+
+#ifdef CRONOS_RTOS
+  /**
+   * @brief create a new task that notifies RTOS task on each firing
+   * 
+   * @param expression crontab scheduling rule string
+   * @param task handle of the task to notify
+   * @param value notification value, i.e. bits to set for the default eSetBits action
+   * @param action notify action, see xTaskNotify()
+   * @return cronos_tid is a Task ID that identifies the task in the scheduler
+   */
+  cronos_tid addNotify(const char* expression, TaskHandle_t task, uint32_t value, eNotifyAction action = eSetBits){
+    return addTask(std::make_unique<CronoS_Notify>(expression, task, value, action));
+  }
+
+  /**
+   * @brief create a new task that posts an item to RTOS queue on each firing
+   * 
+   * @param expression crontab scheduling rule string
+   * @param queue queue handle to post to
+   * @param item an item to post, it's size must match the item size of the queue
+   * @return cronos_tid is a Task ID that identifies the task in the scheduler
    */
-  cronos_tid addCallback(const char* expression, CronoS_Callback_t cb, void* arg = nullptr);
+  template <typename T>
+  cronos_tid addQueue(const char* expression, QueueHandle_t queue, const T& item){
+    return addTask(std::make_unique< CronoS_Queue<T> >(expression, queue, item));
+  }
+#endif  // CRONOS_RTOS
+
+  /**
+   * @brief add a task object to the scheduler
+   * scheduler takes the ownership of the object,
+   * task moved from another shard of CronoS_Sharded keeps it's id
+   * 
+   * @param task an object derived from CronoS_Task
+   * @return cronos_tid is a Task ID that identifies the task in the scheduler
+   */
+  cronos_tid addTask(CronoS_Task_pt task);
 
   /**
    * @brief remore a Task from a scheuler identifid by id
@@ -140,8 +1042,112 @@ public:
    */
   void removeTask(cronos_tid id);
 
+  /**
+   * @brief assign task with id to a group
+   * group's tasks are kept in an intrusive list, so that group operations take the lock once and walk the group's tasks only.
+   * Each operation still republishes the task table snapshot once, which is O(number of tasks), and marks the fire plan
+   * for a rebuild. setGroup() looks the task up by id, which is O(number of tasks) as well
+   * 
+   * @param id task id
+   * @param group group id, 0 - remove task from it's group
+   */
+  void setGroup(cronos_tid id, cronos_gid group);
+
+  /**
+   * @brief disable all tasks of the group
+   * disabled tasks are moved out of the evaluation loop, those are not evaluated and never fire
+   * until enabled back, pending firings are dropped
+   * 
+   * @param group group id
+   */
+  void disableGroup(cronos_gid group);
+
+  /**
+   * @brief enable all tasks of the group
+   * next run times are recalculated from the current time
+   * 
+   * @param group group id
+   */
+  void enableGroup(cronos_gid group);
+
+  /**
+   * @brief remove all tasks of the group
+   * 
+   * @param group group id
+   */
+  void removeGroup(cronos_gid group);
+
+  /**
+   * @brief Set/update cron expression for all tasks of the group
+   * expression is parsed once for the whole group
+   * 
+   * @param group group id
+   * @param expr crontab scheduling rule string
+   */
+  void setGroupExpr(cronos_gid group, const char* expr);
+
+  /**
+   * @brief Get a snapshot of the task table
+   * snapshot is an immutable copy of tasks' configuration that is published by the scheduler when tasks are added, removed,
+   * enabled/disabled, demoted or have their options changed, it could be iterated without any locks and does not delay
+   * task runs, no matter how long it is held. Run state that changes on each firing is not a part of it,
+   * see getNextRun(), getRuns() and saveState()
+   * 
+   * @return CronoS_Snapshot_pt reference-counted snapshot
+   */
+  CronoS_Snapshot_pt getSnapshot() const;
+
+  /**
+   * @brief Get next fire time of the task with id
+   * 
+   * @param id task id
+   * @return time_t fire time, spread applied, CRON_INVALID_INSTANT if there is no such task or it never fires
+   */
+  time_t getNextRun(cronos_tid id);
+
+  /**
+   * @brief Get number of runs of the task with id
+   * 
+   * @param id task id
+   * @return uint32_t number of runs, 0 if there is no such task
+   */
+  uint32_t getRuns(cronos_tid id);
+
+  /**
+   * @brief Get the earliest time some task is due to run
+   * value is updated on each evaluation and task table change, so the call does not iterate tasks nor lock the scheduler,
+   * i.e. to set deep sleep wakeup timer. Coroutines awaiting CronoS::next() are not accounted
+   * 
+   * @return int64_t dispatch time in ms since epoch, offset applied, -1 if no task is scheduled
+   */
+  int64_t nextDeadline() const { return _deadline_ms.load(); }
+
+  /**
+   * @brief save run state of the tasks to a compact blob
+   * blob keeps only ids, next run times and run counters, 16 bytes per task and 12 bytes of header,
+   * so it could be kept in RTC memory over deep sleep, see loadState()
+   * 
+   * @param buffer buffer to write to, if nullptr then only required size is returned
+   * @param len buffer size
+   * @return size_t blob size, 0 if buffer is too small
+   */
+  size_t saveState(uint8_t* buffer, size_t len);
+
+  /**
+   * @brief restore run state of the tasks from a blob made with saveState()
+   * tasks must already be loaded, i.e. by loadImage(), state is applied by task id without
+   * recalculating next run times. Tasks that have become due while sleeping are run once on the first evaluation,
+   * missed repeats are not replayed
+   * 
+   * @param buffer blob data
+   * @param len blob size
+   * @return int number of tasks restored or -1 if blob is invalid, i.e. RTC memory was not retained
+   */
+  int loadState(const uint8_t* buffer, size_t len);
+
   /**
    * @brief Get Crontab string for a task
+   * task is looked up in the task table snapshot
    * 
    * @param id task id
    * @param buffer char buffer to write to (be sure to reserve enough)
@@ -160,6 +1166,345 @@ public:
    */
   void setExpr(cronos_tid id, const char *expr);
 
+  /**
+   * @brief Set spread window for task with id
+   * task's fire times are shifted by a stable offset within the window derived from a hash of task id,
+   * so that multiple tasks with same rule, i.e. "0 * * * * *", do not fire all at the same second
+   * but are evenly distributed over the window. Window should not exceed rule's period
+   * 
+   * @param id task id
+   * @param window spread window in seconds, 0 - disable spreading
+   */
+  void setSpread(cronos_tid id, uint32_t window);
+
+  /**
+   * @brief Set sub-second offset for task with id
+   * task is dispatched at given milliseconds within it's fire second, i.e. at hh:mm:ss.250,
+   * scheduler arms it's timer for the exact delay, so dispatch accuracy is limited by RTOS tick period
+   * 
+   * @param id task id
+   * @param ms offset in milliseconds, 0-999
+   */
+  void setOffset(cronos_tid id, uint16_t ms);
+
+  /**
+   * @brief Set tolerance window for task with id
+   * task could be dispatched later than it's fire time for up to slack seconds,
+   * scheduler picks a wakeup time that satisfies as many pending tasks as possible within their windows,
+   * this reduces the number of timer wakeups for tasks that do not need exact timing,
+   * task does not loose it's runs with a window longer than it's period, slots that are due on a wakeup run one after another.
+   * Note: RTOS timer backend still wakes up each DEFAULT_RESCHEDULING_TIME ms to catch clock adjustments,
+   * so wakeups are only saved if it is raised above the slack windows (reload() is then a must on time adjustments)
+   *
+   * @param id task id
+   * @param slack tolerance window in seconds, 0 - dispatch on time
+   */
+  void setSlack(cronos_tid id, uint32_t slack);
+
+  /**
+   * @brief Set dispatch priority for task with id
+   * when several tasks are due at once, those are dispatched strictly by priority class,
+   * then by deadline, i.e. fire time plus deadline budget, earliest first, then in the order of addition.
+   * Budget does not change the late window, task that is dispatched past it's budget still runs
+   * 
+   * @param id task id
+   * @param priority priority class, higher runs first, 0 - default
+   * @param budget_ms deadline budget in milliseconds, 0 - task's late window, CRONOS_TASK_MAX_LATE_TIME plus slack
+   */
+  void setPriority(cronos_tid id, uint8_t priority, uint32_t budget_ms = 0);
+
+  /**
+   * @brief Set overlap policy for task with id
+   * for jobs that hand their work off to other RTOS tasks and could take longer than their period.
+   * Once a policy is set, each run is tracked as in flight from dispatch until the job reports it with done(),
+   * firings over the limit are skipped or queued and counted in scheduler's stats
+   * 
+   * @param id task id
+   * @param policy overlap policy
+   * @param instances max runs in flight, for CronoS_Overlap::allow 0 - do not track runs (default)
+   */
+  void setOverlap(cronos_tid id, CronoS_Overlap policy, uint8_t instances = 1);
+
+  /**
+   * @brief report that a run of the task with id is done
+   * a queued run, if any, is dispatched right away.
+   * Must not be called from task's callback, it is executed under scheduler's lock,
+   * call it from the worker that completes the job
+   * 
+   * @param id task id
+   */
+  void done(cronos_tid id);
+
+  /**
+   * @brief Set timezone for task with id
+   * task's expression is evaluated in the given timezone instead of the process-wide one,
+   * TZ string is compiled once and the rule is shared by all tasks in the same zone,
+   * process-wide TZ is never changed, so mixed-zone task tables cost the same as single-zone ones
+   * 
+   * @param id task id
+   * @param tz POSIX TZ string, i.e. "CET-1CEST,M3.5.0,M10.5.0/3", nullptr - use process-wide timezone
+   * @return true on success, false if task does not exist or TZ string is invalid
+   */
+  bool setTZ(cronos_tid id, const char* tz);
+
+  /**
+   * @brief Set run budget for task with id
+   * each run of the task is timed, a run that takes longer than the budget is reported by ESP_LOGW
+   * and by overrun function, see onOverrun(). Task that overruns it's budget 'max_overruns' times is demoted,
+   * it is dispatched after all other due tasks regardless of it's priority, if it overruns
+   * 'max_overruns' times more it is disabled. Setting the budget restores demoted and disabled task
+   * 
+   * @param id task id
+   * @param budget_us run budget in microseconds, 0 - do not check runs
+   * @param max_overruns overruns before the task is demoted, 0 - never demote
+   */
+  void setRunBudget(cronos_tid id, uint32_t budget_us, uint8_t max_overruns = 0);
+
+  /**
+   * @brief Set callback time quota
+   * limits the total time spent in task runs within each second, once the quota is exhausted
+   * due tasks are held pending till the next second, so a burst of slow jobs can't starve other RTOS tasks
+   * running on the same core at lower priority than the timer daemon
+   * 
+   * @param us_per_second max time of task runs per second in microseconds, 0 - unlimited
+   */
+  void setCpuQuota(uint32_t us_per_second);
+
+  /**
+   * @brief Set run budget overrun reporting function
+   * function is called from scheduler's context under lock, it must not call scheduler's methods
+   * 
+   * @param f overrun reporting function, nullptr - do not report
+   */
+  void onOverrun(CronoS_Overrun_t f);
+
+  /**
+   * @brief Get task that is being run right now
+   * could be polled from a supervisor task to detect a callback that blocks the scheduler,
+   * it does not lock the scheduler
+   * 
+   * @param elapsed_us if not nullptr, set to time the task is being run for, us
+   * @return cronos_tid id of the task being run, 0 - none
+   */
+  cronos_tid busy(uint32_t* elapsed_us = nullptr) const;
+
+  /**
+   * @brief serialize task table to a binary image
+   * image contains parsed expressions, task ids, task options, next run times and run counters (runs, budget overruns, demotion)
+   * and could be stored to flash/NVS or a file to restore tasks on boot without parsing.
+   * Image is platform specific and must be loaded by the same build configuration
+   * 
+   * @param buffer buffer to write to, if nullptr then only required size is returned
+   * @param len buffer size
+   * @return size_t image size, 0 if buffer is too small
+   */
+  size_t saveImage(uint8_t* buffer, size_t len);
+
+  /**
+   * @brief restore tasks from a binary image made with saveImage()
+   * all tasks are loaded as CronoS_Callback tasks under a single lock with a single timer reschedule,
+   * next run times are kept from the image and recalculated only for the ones that are already in the past.
+   * Tasks which ids already exist in the scheduler are skipped. Binder is called out of the lock, before the duplicates
+   * are known, so it could use the scheduler
+   * 
+   * @param buffer image data
+   * @param len image size
+   * @param binder function that sets callbacks for the restored tasks
+   * @return int number of restored tasks or -1 if image is invalid, corrupt or incompatible
+   */
+  int loadImage(const uint8_t* buffer, size_t len, CronoS_Binder_t binder);
+
+  /**
+   * @brief load tasks from crontab text
+   * each line consists of a cron expression followed by a job name, i.e. "0 0 3 * * * backup",
+   * empty lines and lines starting with '#' are skipped. Job names are mapped to callbacks by resolver.
+   * A line "CRON_TZ=<POSIX TZ string>" sets the timezone for the lines that follow it, an empty value resets it.
+   * Lines are parsed out of lock, then all tasks are added under a single lock with a single timer reschedule
+   * 
+   * @param text crontab text, does not need to be nul-terminated, it is not copied
+   * @param len text length
+   * @param resolver function that maps job names to callbacks
+   * @param onerror optional function to report per-line errors
+   * @return int number of loaded tasks
+   */
+  int loadCrontab(const char* text, size_t len, CronoS_Resolver_t resolver, CronoS_LoadError_t onerror = nullptr);
+
+  /**
+   * @brief Get scheduler counters
+   * 
+   * @return CronoS_Stats 
+   */
+  CronoS_Stats getStats() const;
+
+  /**
+   * @brief reset scheduler counters
+   * 
+   */
+  void resetStats();
+
+  /**
+   * @brief dump trace ring buffer
+   * the last CRONOS_TRACE_SIZE scheduler events in chronological order, to be converted to
+   * Chrome trace / Perfetto JSON by tools/cronos_trace.py. Available when built with -DCRONOS_TRACE,
+   * otherwise only an empty header is written
+   * 
+   * @param buffer buffer to write to, if nullptr then only required size is returned
+   * @param len buffer size
+   * @return size_t dump size, 0 if buffer is too small
+   */
+  size_t dumpTrace(uint8_t* buffer, size_t len) const;
+
+  /**
+   * @brief enable daily fire plan
+   * scheduler compiles a sorted array of fire times for all tasks till the end of the day, at midnight
+   * and on each task table change. Evaluation is then a pointer bump through the array instead of
+   * recalculating next run time of each task on each wakeup. Tasks that fire more than
+   * CRONOS_PLAN_TASK_MAX times a day, or do not fit into 'max_entries', are evaluated live.
+   * reload() MUST be called on time adjustments, clock steps back are detected and the plan is rebuilt
+   * 
+   * @param max_entries max number of entries in the plan, 0 - disable plan
+   */
+  void setPlan(size_t max_entries);
+
+  /**
+   * @brief Get daily fire plan counters
+   * 
+   * @return CronoS_PlanStats 
+   */
+  CronoS_PlanStats getPlanStats() const;
+
+  /**
+   * @brief Get memory counters
+   * counters are library-wide, so with several schedulers those are summed up
+   * 
+   * @return CronoS_MemStats 
+   */
+  static CronoS_MemStats getMemStats();
+
+  /**
+   * @brief reset high-water mark of allocated bytes to the current value
+   * 
+   */
+  static void resetMemPeak();
+
+  /**
+   * @brief sizes of scheduler's data structures in this build
+   * memory cost of a task is callback + list_node + snapshot_entry bytes plus plan entries
+   * for each planned firing and heap storage of the callback's captures, if any
+   * 
+   * @return CronoS_Footprint 
+   */
+  static constexpr CronoS_Footprint footprint(){
+    return { sizeof(CronoS_Task), sizeof(CronoS_Callback), sizeof(cron_expr), sizeof(CronoS_Callback_t),
+              2 * sizeof(void*) + sizeof(CronoS_Task_pt), sizeof(cron_tz), sizeof(CronoS_TaskInfo), sizeof(plan_entry_t), sizeof(CronoS) };
+  }
+
+#ifdef CRONOS_COROUTINES
+  /**
+   * @brief suspend a coroutine until the next fire time of a cron expression
+   * usage: `time_t t = co_await cron.next("0 0 * * * *");`
+   * coroutine is resumed from the scheduler's context, scheduler must be started.
+   * Awaiters of a CronoS_Coro coroutine, or of any coroutine whose promise has a cronos_id member, share one task id
+   * 
+   * @param expression crontab scheduling rule string
+   * @return CronoS_Awaiter awaitable object
+   */
+  CronoS_Awaiter next(const char* expression){ return CronoS_Awaiter(this, expression); }
+#endif
 };
 
+/**
+ * @brief sharded scheduler, a set of CronoS schedulers each running on it's own core
+ * every shard has it's own task table, lock and timer, evaluated in a task/thread pinned to the shard's core,
+ * so simultaneous tasks of different shards could be dispatched in parallel. Tasks are assigned to a shard
+ * explicitly or by a hash of task id, task ids are unique across the shards. Shards do not steal work from each other,
+ * tasks of a busy shard wait for it even if other shards are idle, those could be rebalanced with moveTask().
+ * Per-task options are set via the shard that holds the task, i.e. `cron.find(id)->setSlack(id, 5)`
+ */
+class CronoS_Sharded {
+  // task id counter shared by the shards
+  std::atomic<uint32_t> _ids{0};
+  std::vector< std::unique_ptr<CronoS_Backend> > _backends;
+  std::vector< std::unique_ptr<CronoS> > _shards;
+  // mutex protects the map of tasks to shards
+  std::mutex _mtx;
+  std::unordered_map<cronos_tid, size_t> _map;
+
+  // add task to the shard, -1 - shard is picked by a hash of task id
+  cronos_tid _add(CronoS_Task_pt task, int shard);
+
+  // shard that holds the task, tasks added to a shard directly are looked up in the shards and recorded, _mtx must be held
+  CronoS* _locate(cronos_tid id);
+
+public:
+  /**
+   * @brief Construct a new sharded scheduler
+   * 
+   * @param shards number of shards, shard n runs on core n modulo number of cores, 0 - one shard per core
+   */
+  explicit CronoS_Sharded(unsigned shards = 0);
+  ~CronoS_Sharded();
+
+  // number of shards
+  size_t size() const { return _shards.size(); }
+
+  /**
+   * @brief shard's scheduler
+   * tasks could be added to a shard directly, i.e. with shard(n).loadImage(), those are found by find() on the first lookup.
+   * Tasks should be removed with removeTask() of the sharded scheduler, so it does not route the id to the old shard
+   */
+  CronoS& shard(size_t n){ return *_shards[n]; }
+
+  void start();
+  void stop();
+  void reload();
+
+  /**
+   * @brief create a new task based on `CronoS_Callback` object
+   * 
+   * @param expression crontab scheduling rule string
+   * @param cb functional callback to execute
+   * @param arg callback argument
+   * @param shard shard to put the task to, -1 - pick by a hash of task id
+   * @return cronos_tid task id
+   */
+  cronos_tid addCallback(const char* expression, CronoS_Callback_t cb, void* arg = nullptr, int shard = -1);
+
+  /**
+   * @brief add a task object to the scheduler
+   * 
+   * @param task an object derived from CronoS_Task
+   * @param shard shard to put the task to, -1 - pick by a hash of task id
+   * @return cronos_tid task id
+   */
+  cronos_tid addTask(CronoS_Task_pt task, int shard = -1);
+
+  void removeTask(cronos_tid id);
+
+  /**
+   * @brief move task to another shard
+   * task keeps it's id, options and pending firing, group membership is dropped as groups are per shard
+   * 
+   * @param id task id
+   * @param shard shard to move the task to
+   * @return true on success, false if there is no such task or shard
+   */
+  bool moveTask(cronos_tid id, size_t shard);
+
+  /**
+   * @brief find the shard that holds the task
+   * must not be called from task callbacks for ids unknown to the sharded scheduler, those are looked up in every shard
+   * 
+   * @param id task id
+   * @return CronoS* shard's scheduler, nullptr if there is no such task
+   */
+  CronoS* find(cronos_tid id);
+
+  /**
+   * @brief Get scheduler counters summed up over the shards
+   * 
+   * @return CronoS_Stats 
+   */
+  CronoS_Stats getStats() const;
+};
 
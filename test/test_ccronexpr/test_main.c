@@ -0,0 +1,186 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ccronexpr.h"
+
+static const char* const EXPRS[] = {
+    "* * * * *", "*/5 * * * *", "0 12 * * MON-FRI", "0 0 1 JAN *", "15 10 L * ?", "15 10 LW * ?", "*/15 9-17 * * 1-5",
+    "0 15 10 15W * ?", "0 15 10 ? * 6#3", "0 15 10 ? * 5L", "0 0 12 1/5 * ?", "1,2,3 4-10/2 * * * *", "0 0 0 L-3 * ?",
+    "0 0 0 * * * 2024", "0 0 0 * * * 2024-2030", "0 0 0 * * * 1969", "@daily", "@hourly", "@reboot",
+    /* invalid ones, the error should be the same too */
+    "* * * *", "* * * * * * * *", "60 * * * * *", "* * * 32 * *", "a b c d e", "0 0 L * * 2024", "0 L * * *",
+    "0 0 12 * * FRI#6", "L * * * *", "1-2-3 * * * *", "*/0 * * * *",
+};
+
+void setUp(void){}
+void tearDown(void){}
+
+/* slice parser gives the same result as nul-terminated one, and does not read past the slice */
+void test_parse_slice_matches(void){
+    size_t i;
+    for (i = 0; i != sizeof(EXPRS) / sizeof(EXPRS[0]); i++) {
+        cron_expr a, b;
+        const char *ea, *eb;
+        size_t len = strlen(EXPRS[i]);
+        char* buf = malloc(len + 6);
+        memcpy(buf, EXPRS[i], len);
+        memcpy(buf + len, " 9 9 X", 6);
+        memset(&a, 0, sizeof(a));
+        memset(&b, 0xff, sizeof(b));
+        cron_parse_expr(EXPRS[i], &a, &ea);
+        cron_parse_expr_n(buf, len, &b, &eb);
+        free(buf);
+        TEST_ASSERT_EQUAL_MESSAGE(!ea, !eb, EXPRS[i]);
+        if (ea) TEST_ASSERT_EQUAL_STRING(ea, eb);
+        else TEST_ASSERT_EQUAL_MEMORY(&a, &b, sizeof(a));
+    }
+}
+
+/* surrounding whitespace and tabs are taken by the slice parser only */
+void test_parse_slice_whitespace(void){
+    cron_expr a, b;
+    const char* err;
+    cron_parse_expr("0 0 12 * * MON", &a, &err);
+    TEST_ASSERT_NULL(err);
+    cron_parse_expr_n("  0 0\t12 * * MON \n", 18, &b, &err);
+    TEST_ASSERT_NULL(err);
+    TEST_ASSERT_EQUAL_MEMORY(&a, &b, sizeof(a));
+    cron_parse_expr(" 0 0 12 * * MON", &a, &err);
+    TEST_ASSERT_NOT_NULL(err);
+}
+
+/* expression with more tokens than are kept is parsed the same */
+void test_parse_slice_long(void){
+    char text[512];
+    cron_expr a, b;
+    const char *ea, *eb;
+    int i, five;
+    for (five = 0; five != 2; five++) {
+        strcpy(text, "0 ");
+        for (i = 0; i != 60; i++) sprintf(text + strlen(text), i ? ",%d" : "%d", i);
+        strcat(text, five ? " * * * *" : " * * * * *");
+        cron_parse_expr(text + (five ? 2 : 0), &a, &ea);
+        cron_parse_expr_n(text + (five ? 2 : 0), strlen(text + (five ? 2 : 0)), &b, &eb);
+        TEST_ASSERT_NULL(ea);
+        TEST_ASSERT_NULL(eb);
+        TEST_ASSERT_EQUAL_MEMORY(&a, &b, sizeof(a));
+    }
+}
+
+/* 'L', 'W' and '#' rules fire at the time of the rule only, also when the matching day falls on the same day number of another month */
+void test_day_rules_keep_time(void){
+    static const char* const rules[] = {
+        "0 0 12 L * ?", "0 0 12 L-3 * ?", "0 0 12 LW * ?", "0 0 12 15W * ?", "0 0 12 31W * ?", "0 0 12 ? * 6#3", "0 0 12 ? * 5L",
+    };
+    cron_expr expr;
+    const char* err;
+    time_t date;
+    size_t i;
+    int n;
+    setenv("TZ", "UTC0", 1);
+    tzset();
+    for (i = 0; i != sizeof(rules) / sizeof(rules[0]); i++) {
+        cron_parse_expr(rules[i], &expr, &err);
+        TEST_ASSERT_NULL(err);
+        for (date = 1700000000, n = 0; n != 100; n++) {
+            date = cron_next(&expr, date);
+            TEST_ASSERT_EQUAL_MESSAGE(12 * 3600, (int) (date % 86400), rules[i]);
+        }
+        for (date = 1800000000, n = 0; n != 100; n++) {
+            date = cron_prev(&expr, date);
+            TEST_ASSERT_EQUAL_MESSAGE(12 * 3600, (int) (date % 86400), rules[i]);
+        }
+    }
+}
+
+/* fields that moved to their next value are reset once a higher field moves too */
+void test_moved_fields_reset(void){
+    static const struct { const char* rule; time_t date; time_t next; time_t prev; } cases[] = {
+        /* 2027-04-10 15:23:19, 23:00:00 and 13:59:45 */
+        { "*/15 * 1,13,23 * * *", 1807370599, 1807398000, 1807365585 },
+        /* 2022-01-04 22:13:21, 22:15:00 and 22:00:45 */
+        { "0,10,45 */15 * * * *", 1641334401, 1641334500, 1641333645 },
+    };
+    cron_expr expr;
+    const char* err;
+    size_t i;
+    setenv("TZ", "UTC0", 1);
+    tzset();
+    for (i = 0; i != sizeof(cases) / sizeof(cases[0]); i++) {
+        cron_parse_expr(cases[i].rule, &expr, &err);
+        TEST_ASSERT_NULL(err);
+        TEST_ASSERT_EQUAL_MESSAGE(cases[i].next, cron_next(&expr, cases[i].date), cases[i].rule);
+        TEST_ASSERT_EQUAL_MESSAGE(cases[i].prev, cron_prev(&expr, cases[i].date), cases[i].rule);
+    }
+}
+
+/* searches across CET daylight saving time transitions of 2024 */
+void test_dst_transitions(void){
+    /* 'tz_only' cases land on ambiguous local time, the _tz search resolves it to DST, mktime() of the local one picks either */
+    static const struct { const char* rule; time_t date; int prev; int tz_only; time_t expected; } cases[] = {
+        /* 2024-03-31 12:00 CEST, the day of the spring forward */
+        { "0 0 12 L * ?",      1711800000, 0, 0, 1711879200 },
+        /* 02:30 falls into the gap of 2024-03-31, next one is 2024-04-01 02:30 CEST */
+        { "0 30 2 * * *",      1711836000, 0, 0, 1711931400 },
+        /* 2024-10-27 02:30 CEST, the first of the repeated hour */
+        { "0 30 2 * * *",      1729902600, 0, 1, 1729989000 },
+        /* 2024-03-31 00:00 CET, before the spring forward */
+        { "0 0 0 L * MON-FRI", 1711900000, 1, 0, 1711839600 },
+    };
+    cron_expr expr;
+    cron_tz tz;
+    const char* err;
+    size_t i;
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+    cron_parse_tz("CET-1CEST,M3.5.0,M10.5.0/3", &tz, &err);
+    TEST_ASSERT_NULL(err);
+    for (i = 0; i != sizeof(cases) / sizeof(cases[0]); i++) {
+        cron_parse_expr(cases[i].rule, &expr, &err);
+        TEST_ASSERT_NULL(err);
+        TEST_ASSERT_EQUAL_MESSAGE(cases[i].expected, cases[i].prev ? cron_prev_tz(&expr, &tz, cases[i].date) : cron_next_tz(&expr, &tz, cases[i].date), cases[i].rule);
+#ifdef CRON_USE_LOCAL_TIME
+        if (!cases[i].tz_only) TEST_ASSERT_EQUAL_MESSAGE(cases[i].expected, cases[i].prev ? cron_prev(&expr, cases[i].date) : cron_next(&expr, cases[i].date), cases[i].rule);
+#endif
+    }
+}
+
+/* count across the fall-back agrees with a chain of cron_next() from an earlier day, continued enumeration gives the same dates */
+void test_between_fall_back(void){
+    static const char* const rules[] = { "0 30 2 * * *", "0 */20 2 * * *", "0 0 * * * *", "*/30 59 2 * * *" };
+    /* 2024-10-25 00:00:00 CEST to 2024-10-29 00:00:00 CET */
+    const time_t from = 1729807200, to = 1730156400;
+    time_t all[256], one[1], date;
+    cron_expr expr;
+    const char* err;
+    size_t i;
+    int n, k, chain;
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+    for (i = 0; i != sizeof(rules) / sizeof(rules[0]); i++) {
+        cron_parse_expr(rules[i], &expr, &err);
+        TEST_ASSERT_NULL(err);
+        for (chain = 0, date = cron_next(&expr, from - 1); date != CRON_INVALID_INSTANT && date < to; date = cron_next(&expr, date)) chain++;
+        n = cron_enumerate_between(&expr, from, to, all, 256);
+        TEST_ASSERT_EQUAL_MESSAGE(chain, n, rules[i]);
+        TEST_ASSERT_EQUAL_MESSAGE(chain, cron_count_between(&expr, from, to), rules[i]);
+        for (k = 0, date = from; cron_enumerate_between(&expr, date, to, one, 1) == 1; date = one[0] + 1, k++) {
+            TEST_ASSERT_TRUE(k < n);
+            TEST_ASSERT_EQUAL_MESSAGE(all[k], one[0], rules[i]);
+        }
+        TEST_ASSERT_EQUAL_MESSAGE(n, k, rules[i]);
+    }
+}
+
+int main(int argc, char** argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_parse_slice_matches);
+    RUN_TEST(test_parse_slice_whitespace);
+    RUN_TEST(test_parse_slice_long);
+    RUN_TEST(test_day_rules_keep_time);
+    RUN_TEST(test_moved_fields_reset);
+    RUN_TEST(test_dst_transitions);
+    RUN_TEST(test_between_fall_back);
+    return UNITY_END();
+}
@@ -0,0 +1,139 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "ccronexpr.h"
+
+/* number of random expressions, and seconds before each fire time checked not to match */
+#define CASES       3000
+#define GAP         600
+
+static const char* const SECONDS[] = { "*", "0", "30", "*/15", "5-20", "0,10,45" };
+static const char* const HOURS[] = { "*", "0", "12", "*/6", "9-17", "1,13,23" };
+static const char* const DAYS[] = { "*", "?", "1", "15", "*/5", "L", "LW", "15W", "1W", "L-3", "29,30,31" };
+static const char* const MONTHS[] = { "*", "1", "2", "*/3", "JAN-JUN", "2,8,12" };
+static const char* const WEEKDAYS[] = { "*", "?", "MON-FRI", "0", "6#3", "5L", "1,3,5" };
+
+#define PICK(a) a[rnd() % (sizeof(a) / sizeof(a[0]))]
+
+static uint32_t seed;
+
+/* xorshift32, runs are repeatable */
+static uint32_t rnd(void){
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+}
+
+/* random time between 2020 and 2030 */
+static time_t rnd_time(void){
+    return 1577836800 + (time_t) (rnd() % (10u * 365 * 86400));
+}
+
+static int rnd_expr(cron_expr* expr, char* text, size_t len){
+    const char* err = NULL;
+    snprintf(text, len, "%s %s %s %s %s %s", PICK(SECONDS), PICK(SECONDS), PICK(HOURS), PICK(DAYS), PICK(MONTHS), PICK(WEEKDAYS));
+    cron_parse_expr(text, expr, &err);
+    return err == NULL;
+}
+
+static struct tm* calendar(time_t t, struct tm* buf){
+#ifdef CRON_USE_LOCAL_TIME
+    return localtime_r(&t, buf);
+#else
+    return gmtime_r(&t, buf);
+#endif
+}
+
+void setUp(void){
+    setenv("TZ", "UTC0", 1);
+    tzset();
+    seed = 2463534242u;
+}
+
+void tearDown(void){}
+
+/* conversion to v2 and back gives the same bytes */
+void test_v2_round_trip(void){
+    int i;
+    char text[96];
+    for (i = 0; i != CASES; i++) {
+        cron_expr a, b;
+        cron_expr_v2 v2;
+        if (!rnd_expr(&a, text, sizeof(text))) continue;
+        cron_expr_to_v2(&a, &v2);
+        memset(&b, 0xff, sizeof(b));
+        cron_expr_from_v2(&v2, &b);
+        TEST_ASSERT_EQUAL_MEMORY(&a, &b, sizeof(a));
+    }
+}
+
+/* v2 matcher agrees with cron_next() on the v1 bit arrays: the next fire time matches, seconds before it don't */
+void test_v2_matches_next(void){
+    int i, n = 0;
+    char text[96], msg[160];
+    for (i = 0; i != CASES; i++) {
+        cron_expr expr;
+        cron_expr_v2 v2;
+        struct tm tm;
+        time_t from = rnd_time(), next, t;
+        if (!rnd_expr(&expr, text, sizeof(text))) continue;
+        cron_expr_to_v2(&expr, &v2);
+        next = cron_next(&expr, from);
+        if (next == CRON_INVALID_INSTANT) continue;
+        snprintf(msg, sizeof(msg), "%s from %lld", text, (long long) from);
+        if (!cron_match_v2(&v2, calendar(next, &tm))) TEST_ASSERT_EQUAL_MESSAGE(1, 0, msg);
+        for (t = next - 1; t > from && t >= next - GAP; t--) {
+            if (cron_match_v2(&v2, calendar(t, &tm))) TEST_ASSERT_EQUAL_MESSAGE(0, 1, msg);
+        }
+        n++;
+    }
+    /* most of the random expressions are valid */
+    TEST_ASSERT_TRUE(n > CASES / 2);
+}
+
+/* throughput of the v2 matcher and of cron_next() on the same expressions */
+void test_v2_throughput(void){
+    static cron_expr exprs[256];
+    static cron_expr_v2 v2s[256];
+    static struct tm tms[1024];
+    char text[96], msg[128];
+    int n = 0, i, hits = 0;
+    long calls;
+    clock_t c;
+    double match_s, next_s;
+    time_t sink = 0;
+    while (n != 256) {
+        if (!rnd_expr(&exprs[n], text, sizeof(text))) continue;
+        cron_expr_to_v2(&exprs[n], &v2s[n]);
+        n++;
+    }
+    for (i = 0; i != 1024; i++) {
+        time_t t = rnd_time();
+        calendar(t, &tms[i]);
+    }
+
+    c = clock();
+    for (calls = 0; calls != 4000000; calls++)
+        hits += cron_match_v2(&v2s[calls & 255], &tms[(calls >> 8) & 1023]);
+    match_s = (double) (clock() - c) / CLOCKS_PER_SEC;
+
+    c = clock();
+    for (i = 0; i != 20000; i++)
+        sink ^= cron_next(&exprs[i & 255], mktime(&tms[(i >> 8) & 1023]));
+    next_s = (double) (clock() - c) / CLOCKS_PER_SEC;
+
+    snprintf(msg, sizeof(msg), "cron_match_v2: %.0f matches/s (%d hits), cron_next: %.0f calls/s (%lld)",
+             calls / (match_s > 0 ? match_s : 1e-9), hits, i / (next_s > 0 ? next_s : 1e-9), (long long) (sink & 1));
+    TEST_MESSAGE(msg);
+}
+
+int main(int argc, char** argv){
+    UNITY_BEGIN();
+    RUN_TEST(test_v2_round_trip);
+    RUN_TEST(test_v2_matches_next);
+    RUN_TEST(test_v2_throughput);
+    return UNITY_END();
+}
@@ -0,0 +1,157 @@
+#include <unity.h>
+#include <chrono>
+#include <vector>
+#include "cronos.hpp"
+
+// 2024-01-01 00:00:00 UTC
+static constexpr int64_t t0 = 1704067200000LL;
+
+void setUp(void){
+  setenv("TZ", "UTC0", 1);
+  tzset();
+}
+
+void tearDown(void){}
+
+static void spin(cronos_tid, void*){
+  auto until = std::chrono::steady_clock::now() + std::chrono::milliseconds(3);
+  while (std::chrono::steady_clock::now() < until);
+}
+
+static void noop(cronos_tid, void*){}
+
+static uint32_t runs;
+static void count(cronos_tid, void*){ ++runs; }
+
+static bool bind(cronos_tid, CronoS_Callback_t &cb, void*&){
+  cb = noop;
+  return true;
+}
+
+static std::vector<uint8_t> save(CronoS &cron){
+  std::vector<uint8_t> img(cron.saveImage(nullptr, 0));
+  TEST_ASSERT_EQUAL(img.size(), cron.saveImage(img.data(), img.size()));
+  return img;
+}
+
+// run counters and demotion state survive the image round trip
+void test_image_keeps_run_state(void){
+  CronoS_SimBackend sim(t0);
+  CronoS a(&sim);
+  a.addCallback("*/10 * * * * *", noop);
+  cronos_tid slow = a.addCallback("0 * * * * *", spin);
+  // every second run overruns the budget twice, the task is demoted after 2 runs
+  a.setRunBudget(slow, 1000, 2);
+  a.start();
+  sim.run(t0 + 180500);
+  std::vector<uint8_t> img = save(a);
+
+  CronoS b(&sim);
+  TEST_ASSERT_EQUAL(2, b.loadImage(img.data(), img.size(), bind));
+  TEST_ASSERT_EQUAL(3, b.getRuns(slow));
+  for (auto &i : *b.getSnapshot()){
+    if (i.id == slow)
+      TEST_ASSERT_EQUAL(1, i.demoted);
+  }
+  // overruns counter since the demotion is kept too, so images match byte to byte
+  std::vector<uint8_t> copy = save(b);
+  TEST_ASSERT_EQUAL(img.size(), copy.size());
+  TEST_ASSERT_EQUAL_MEMORY(img.data(), copy.data(), img.size());
+
+  // ids generated after the load do not collide with the restored ones
+  TEST_ASSERT_TRUE(b.addCallback("0 0 * * * *", noop) > slow);
+}
+
+// image made by a shard records the counter shared by all shards
+void test_image_shared_ids(void){
+  CronoS_Sharded s(2);
+  s.addCallback("0 0 * * * *", noop, nullptr, 0);
+  cronos_tid last = s.addCallback("0 0 * * * *", noop, nullptr, 1);
+  std::vector<uint8_t> img = save(s.shard(0));
+
+  CronoS_SimBackend sim(t0);
+  CronoS c(&sim);
+  TEST_ASSERT_EQUAL(1, c.loadImage(img.data(), img.size(), bind));
+  TEST_ASSERT_TRUE(c.addCallback("0 0 * * * *", noop) > last);
+}
+
+// images of another version or build configuration are rejected
+void test_image_rejects_mismatch(void){
+  CronoS_SimBackend sim(t0);
+  CronoS a(&sim);
+  a.addCallback("0 0 * * * *", noop);
+  std::vector<uint8_t> img = save(a);
+  // version field follows the magic
+  ++img[4];
+  CronoS b(&sim);
+  TEST_ASSERT_EQUAL(-1, b.loadImage(img.data(), img.size(), bind));
+  --img[4];
+  // raw cron_expr size follows the id counter
+  ++img[16];
+  TEST_ASSERT_EQUAL(-1, b.loadImage(img.data(), img.size(), bind));
+  --img[16];
+  TEST_ASSERT_EQUAL(-1, b.loadImage(img.data(), img.size() - 1, bind));
+  TEST_ASSERT_EQUAL(1, b.loadImage(img.data(), img.size(), bind));
+}
+
+// a damaged entry fails the checksum, the image is not loaded partially
+void test_image_rejects_corrupt(void){
+  CronoS_SimBackend sim(t0);
+  CronoS a(&sim);
+  a.addCallback("0 0 * * * *", noop);
+  a.addCallback("0 0 3 * * *", noop);
+  std::vector<uint8_t> img = save(a);
+  img[img.size() - 1] ^= 1;
+  CronoS b(&sim);
+  TEST_ASSERT_EQUAL(-1, b.loadImage(img.data(), img.size(), bind));
+  TEST_ASSERT_EQUAL(0, b.getSnapshot()->size());
+}
+
+// binder runs out of the scheduler's lock and could use it
+void test_image_binder_reentrant(void){
+  CronoS_SimBackend sim(t0);
+  CronoS a(&sim);
+  cronos_tid id = a.addCallback("0 0 * * * *", noop);
+  std::vector<uint8_t> img = save(a);
+  CronoS b(&sim);
+  auto binder = [&](cronos_tid i, CronoS_Callback_t &cb, void*&){
+    cb = noop;
+    return b.getNextRun(i) == CRON_INVALID_INSTANT;
+  };
+  TEST_ASSERT_EQUAL(1, b.loadImage(img.data(), img.size(), binder));
+  TEST_ASSERT_EQUAL(a.getNextRun(id), b.getNextRun(id));
+}
+
+// next run times past the 32 bit seconds counter survive the run state round trip
+void test_state_keeps_far_next_run(void){
+  // 2106-02-07 06:20:00 UTC, the counter wraps at 06:28:16
+  constexpr int64_t t1 = 4294966800000LL;
+  CronoS_SimBackend sim(t1);
+  CronoS a(&sim);
+  cronos_tid id = a.addCallback("0 0 * * * *", count);
+  std::vector<uint8_t> img = save(a);
+  std::vector<uint8_t> state(a.saveState(nullptr, 0));
+  TEST_ASSERT_EQUAL(state.size(), a.saveState(state.data(), state.size()));
+
+  CronoS_SimBackend sim2(t1);
+  CronoS b(&sim2);
+  TEST_ASSERT_EQUAL(1, b.loadImage(img.data(), img.size(), [](cronos_tid, CronoS_Callback_t &cb, void*&){ cb = count; return true; }));
+  TEST_ASSERT_EQUAL(1, b.loadState(state.data(), state.size()));
+  TEST_ASSERT_TRUE(b.getNextRun(id) == a.getNextRun(id));
+  // a truncated next run time would be long past and run the task right away
+  runs = 0;
+  b.start();
+  sim2.run(t1 + 60000);
+  TEST_ASSERT_EQUAL(0, runs);
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_image_keeps_run_state);
+  RUN_TEST(test_image_shared_ids);
+  RUN_TEST(test_image_rejects_mismatch);
+  RUN_TEST(test_image_rejects_corrupt);
+  RUN_TEST(test_image_binder_reentrant);
+  RUN_TEST(test_state_keeps_far_next_run);
+  return UNITY_END();
+}
@@ -0,0 +1,127 @@
+#include <unity.h>
+#include <cstring>
+#include "cronos.hpp"
+
+// 2024-01-01 00:00:00 UTC
+static constexpr int64_t t0 = 1704067200000LL;
+static uint32_t runs;
+
+void setUp(void){
+  setenv("TZ", "UTC0", 1);
+  tzset();
+  runs = 0;
+}
+
+void tearDown(void){}
+
+// runs of 'n' tasks with 'rule' over a simulated day
+static uint32_t count_runs(const char* rule, int n, uint32_t slack, size_t plan){
+  runs = 0;
+  CronoS_SimBackend sim(t0);
+  CronoS cron(&sim);
+  if (plan)
+    cron.setPlan(plan);
+  for (int i = 0; i != n; ++i)
+    cron.setSlack(cron.addCallback(rule, [](cronos_tid, void*){ ++runs; }), slack);
+  cron.start();
+  sim.run(t0 + 86400000);
+  return runs;
+}
+
+// a wakeup delayed by the tolerance window must not skip slots of the task, even when the window is longer than the period
+void test_slack_keeps_runs(void){
+  for (size_t plan : {0, 64}){
+    for (uint32_t slack : {0, 30, 59, 60, 90, 150, 3600}){
+      TEST_ASSERT_EQUAL(60, count_runs("0 * 10 * * *", 1, slack, plan));
+      TEST_ASSERT_EQUAL(600, count_runs("0 * 10 * * *", 10, slack, plan));
+      TEST_ASSERT_EQUAL(540, count_runs("*/20 * 10 * * *", 3, slack, plan));
+    }
+  }
+}
+
+// tasks sharing a window are dispatched on the same wakeup
+void test_slack_groups_wakeups(void){
+  CronoS_SimBackend sim(t0);
+  CronoS cron(&sim);
+  cron.setSlack(cron.addCallback("0 * 1 * * *", [](cronos_tid, void*){ ++runs; }), 30);
+  cron.setSlack(cron.addCallback("20 * 1 * * *", [](cronos_tid, void*){ ++runs; }), 30);
+  cron.start();
+  sim.run(t0 + 3 * 3600000);
+  TEST_ASSERT_EQUAL(120, runs);
+  TEST_ASSERT_TRUE(cron.getStats().wakeups <= 62);
+}
+
+// crontab is read from a slice of a buffer, the last line has no newline
+void test_crontab_slice(void){
+  CronoS_SimBackend sim(t0);
+  CronoS cron(&sim);
+  static const char tab[] = "# jobs\n0 0 3 * * * backup\n\n*/5 * * * * * poll\n0 0 * * * * spare";
+  unsigned errors{0};
+  auto resolver = [](const char*, size_t, CronoS_Callback_t &cb, void*&){ cb = [](cronos_tid, void*){ ++runs; }; return true; };
+  // the slice ends right after "poll"
+  int n = cron.loadCrontab(tab, std::strstr(tab, "poll") + 4 - tab, resolver, [&](unsigned, const char*){ ++errors; });
+  TEST_ASSERT_EQUAL(2, n);
+  TEST_ASSERT_EQUAL(0, errors);
+  TEST_ASSERT_EQUAL(3, cron.loadCrontab(tab, sizeof(tab) - 1, resolver));
+}
+
+// firings do not republish the task table snapshot, run state is read from the scheduler
+void test_snapshot_on_changes_only(void){
+  CronoS_SimBackend sim(t0);
+  CronoS cron(&sim);
+  cronos_tid id = cron.addCallback("*/10 * * * * *", [](cronos_tid, void*){ ++runs; });
+  cron.start();
+  auto snap = cron.getSnapshot();
+  TEST_ASSERT_EQUAL(1, snap->size());
+  sim.run(t0 + 60500);
+  TEST_ASSERT_EQUAL(6, runs);
+  TEST_ASSERT_EQUAL(6, cron.getRuns(id));
+  TEST_ASSERT_TRUE(snap == cron.getSnapshot());
+  TEST_ASSERT_EQUAL(t0 / 1000 + 70, cron.getNextRun(id));
+  TEST_ASSERT_EQUAL(t0 + 70000, cron.nextDeadline());
+
+  cron.setSlack(id, 5);
+  TEST_ASSERT_TRUE(snap != cron.getSnapshot());
+  TEST_ASSERT_EQUAL(5, cron.getSnapshot()->front().slack);
+  cron.removeTask(id);
+  TEST_ASSERT_EQUAL(0, cron.getSnapshot()->size());
+  TEST_ASSERT_EQUAL(-1, cron.nextDeadline());
+  TEST_ASSERT_EQUAL(CRON_INVALID_INSTANT, cron.getNextRun(id));
+}
+
+// task added with a zone is evaluated in it from the start, an unknown zone adds no task
+void test_callback_tz(void){
+  CronoS_SimBackend sim(t0);
+  CronoS cron(&sim);
+  cronos_tid id = cron.addCallback("0 0 1 * * *", [](cronos_tid, void*){ ++runs; }, nullptr, 0, "CET-1");
+  TEST_ASSERT_TRUE(id != 0);
+  TEST_ASSERT_EQUAL(t0 / 1000 + 86400, cron.getNextRun(id));
+  TEST_ASSERT_EQUAL(0, cron.addCallback("0 0 1 * * *", [](cronos_tid, void*){ ++runs; }, nullptr, 0, "no zone"));
+  TEST_ASSERT_EQUAL(1, cron.getSnapshot()->size());
+}
+
+// backend that outlives the scheduler no longer calls into it
+void test_backend_outlives(void){
+  CronoS_SimBackend sim(t0);
+  {
+    CronoS cron(&sim);
+    cron.addCallback("* * * * * *", [](cronos_tid, void*){ ++runs; });
+    cron.start();
+    sim.run(t0 + 2500);
+  }
+  uint32_t n = runs;
+  sim.arm(0);
+  TEST_ASSERT_EQUAL(1, sim.run(t0 + 5000));
+  TEST_ASSERT_EQUAL(n, runs);
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_slack_keeps_runs);
+  RUN_TEST(test_slack_groups_wakeups);
+  RUN_TEST(test_crontab_slice);
+  RUN_TEST(test_snapshot_on_changes_only);
+  RUN_TEST(test_callback_tz);
+  RUN_TEST(test_backend_outlives);
+  return UNITY_END();
+}
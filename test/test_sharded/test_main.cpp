@@ -0,0 +1,115 @@
+#include <unity.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include "cronos.hpp"
+
+// number of jobs firing at the same second and CPU time each one spends, us
+#define JOBS      32
+#define JOB_COST  2000
+
+using steady = std::chrono::steady_clock;
+
+static std::atomic<uint32_t> runs{0};
+// start of the first job and completion of the last one of a burst, us since steady clock's epoch
+static std::atomic<int64_t> first_start{0}, last_done{0};
+
+void setUp(void){
+  runs = 0;
+  first_start = 0;
+  last_done = 0;
+}
+
+void tearDown(void){}
+
+static int64_t now_us(){
+  return std::chrono::duration_cast<std::chrono::microseconds>(steady::now().time_since_epoch()).count();
+}
+
+static void noop(cronos_tid, void*){}
+
+static void busy_job(cronos_tid, void*){
+  int64_t zero = 0;
+  first_start.compare_exchange_strong(zero, now_us());
+  auto until = steady::now() + std::chrono::microseconds(JOB_COST);
+  while (steady::now() < until);
+  // the last job of the first burst
+  if (++runs == JOBS)
+    last_done = now_us();
+}
+
+// tasks added to a shard directly are routed by the sharded scheduler
+void test_shard_direct_ids(void){
+  CronoS_Sharded s(2);
+  cronos_tid a = s.addCallback("0 0 * * * *", noop, nullptr, 0);
+  cronos_tid b = s.shard(1).addCallback("0 0 * * * *", noop);
+  TEST_ASSERT_TRUE(b > a);
+  TEST_ASSERT_TRUE(s.find(b) == &s.shard(1));
+  TEST_ASSERT_TRUE(s.moveTask(b, 0));
+  TEST_ASSERT_TRUE(s.find(b) == &s.shard(0));
+  TEST_ASSERT_EQUAL(2, s.shard(0).getSnapshot()->size());
+  s.removeTask(b);
+  TEST_ASSERT_NULL(s.find(b));
+  TEST_ASSERT_FALSE(s.moveTask(b, 1));
+}
+
+// shard indexes past 255 are routed to their own shard
+void test_shard_many(void){
+  CronoS_Sharded s(260);
+  cronos_tid id = s.addCallback("0 0 * * * *", noop, nullptr, 259);
+  TEST_ASSERT_TRUE(s.find(id) == &s.shard(259));
+  s.removeTask(id);
+  TEST_ASSERT_EQUAL(0, s.shard(259).getSnapshot()->size());
+}
+
+// shards are destroyed while their loops are evaluating
+void test_shard_teardown(void){
+  for (int i = 0; i != 20; ++i){
+    CronoS_Sharded s(2);
+    for (int j = 0; j != 8; ++j)
+      s.addCallback("* * * * * *", noop);
+    s.start();
+  }
+}
+
+// time to drain the first burst of simultaneous jobs, us
+static int64_t drain(unsigned shards){
+  runs = 0;
+  first_start = 0;
+  last_done = 0;
+  CronoS_Sharded cron(shards);
+  for (int i = 0; i != JOBS; ++i)
+    cron.addCallback("* * * * * *", busy_job);
+  cron.start();
+  // burst fires on the next second
+  for (int i = 0; i != 300 && !last_done; ++i)
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+  cron.stop();
+  TEST_ASSERT_TRUE(last_done != 0);
+  return last_done - first_start;
+}
+
+// shards on separate cores drain a burst faster than a single shard
+void test_shard_burst(void){
+  unsigned cores = std::max(std::thread::hardware_concurrency(), 1u);
+  if (cores < 2)
+    TEST_IGNORE_MESSAGE("single core host, shards can't run in parallel");
+  char msg[96];
+  int64_t one = drain(1);
+  int64_t all = drain(0);
+  std::snprintf(msg, sizeof(msg), "burst of %d jobs: 1 shard %lld us, %u shards %lld us", JOBS, (long long)one, cores, (long long)all);
+  TEST_MESSAGE(msg);
+  // jobs are spread by a hash of their ids, so shards are not loaded evenly
+  TEST_ASSERT_TRUE(all * 4 < one * 3);
+}
+
+int main(int, char**){
+  UNITY_BEGIN();
+  RUN_TEST(test_shard_direct_ids);
+  RUN_TEST(test_shard_many);
+  RUN_TEST(test_shard_teardown);
+  RUN_TEST(test_shard_burst);
+  return UNITY_END();
+}
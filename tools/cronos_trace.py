@@ -0,0 +1,96 @@
+#!/usr/bin/env python3
+"""
+Converts CronoS trace dump to Chrome trace / Perfetto JSON
+
+Dump is the binary buffer written by CronoS::dumpTrace() on a build with -DCRONOS_TRACE,
+i.e. saved to a file or printed as hex to the console. Result could be opened
+with chrome://tracing or https://ui.perfetto.dev
+
+usage: cronos_trace.py dump.bin [-o trace.json]
+       cronos_trace.py --hex dump.txt [-o trace.json]
+"""
+
+import argparse
+import json
+import struct
+import sys
+
+TRACE_MAGIC = 0x52545243  # "CRTR"
+TRACE_VERSION = 1
+
+# CronoS_TraceEvent
+WAKEUP, DUE, RUN_START, RUN_END, NEXT_RUN, ARM, TIME_JUMP = range(1, 8)
+
+HEADER = struct.Struct("<IHHI")
+ENTRY = struct.Struct("<IIiB3x")
+
+
+def parse(data):
+    magic, version, entry_size, count = HEADER.unpack_from(data)
+    if magic != TRACE_MAGIC or version != TRACE_VERSION or entry_size != ENTRY.size:
+        raise ValueError("not a CronoS trace dump or unsupported version")
+    if len(data) < HEADER.size + count * ENTRY.size:
+        raise ValueError("trace dump is truncated")
+
+    events = []
+    # timestamps are 32 bit us and wrap around every ~71 minutes, unwrap them
+    base = 0
+    prev = None
+    for i in range(count):
+        ts, tid, value, event = ENTRY.unpack_from(data, HEADER.size + i * ENTRY.size)
+        if prev is not None and ts < prev:
+            base += 1 << 32
+        prev = ts
+        events.append((base + ts, event, tid, value))
+    return events
+
+
+def convert(events):
+    out = []
+    # scheduler events go to thread 0, runs of each task go to own thread named after task id
+    tasks = set()
+    for ts, event, tid, value in events:
+        if event == RUN_START:
+            tasks.add(tid)
+            out.append({"name": "run", "ph": "B", "ts": ts, "pid": 1, "tid": tid})
+        elif event == RUN_END:
+            tasks.add(tid)
+            out.append({"name": "run", "ph": "E", "ts": ts, "pid": 1, "tid": tid, "args": {"us": value}})
+        elif event == WAKEUP:
+            out.append({"name": "yield" if value else "wakeup", "ph": "i", "s": "t", "ts": ts, "pid": 1, "tid": 0})
+        elif event == DUE:
+            out.append({"name": "due", "ph": "i", "s": "t", "ts": ts, "pid": 1, "tid": tid, "args": {"late_ms": value}})
+        elif event == NEXT_RUN:
+            out.append({"name": "next_run", "ph": "i", "s": "t", "ts": ts, "pid": 1, "tid": tid, "args": {"next_run": value & 0xffffffff}})
+        elif event == ARM:
+            out.append({"name": "arm", "ph": "i", "s": "t", "ts": ts, "pid": 1, "tid": 0, "args": {"delay_ms": value}})
+        elif event == TIME_JUMP:
+            out.append({"name": "time_jump", "ph": "i", "s": "p", "ts": ts, "pid": 1, "tid": 0, "args": {"step_ms": value}})
+
+    out.append({"name": "process_name", "ph": "M", "pid": 1, "args": {"name": "CronoS"}})
+    out.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": 0, "args": {"name": "scheduler"}})
+    for tid in sorted(tasks):
+        out.append({"name": "thread_name", "ph": "M", "pid": 1, "tid": tid, "args": {"name": "task %u" % tid}})
+    return {"traceEvents": out, "displayTimeUnit": "ms"}
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Convert CronoS trace dump to Chrome trace / Perfetto JSON")
+    ap.add_argument("dump", help="binary dump file, '-' for stdin")
+    ap.add_argument("--hex", action="store_true", help="dump is a hex string, whitespace is ignored")
+    ap.add_argument("-o", "--output", help="output JSON file, stdout by default")
+    args = ap.parse_args()
+
+    src = sys.stdin.buffer if args.dump == "-" else open(args.dump, "rb")
+    data = src.read()
+    if args.hex:
+        data = bytes.fromhex("".join(data.decode().split()))
+
+    trace = convert(parse(data))
+    dst = open(args.output, "w") if args.output else sys.stdout
+    json.dump(trace, dst, indent=1)
+    dst.write("\n")
+
+
+if __name__ == "__main__":
+    main()